@@ -139,18 +139,20 @@ int main(int argc, char **argv) {
 
   auto dispatcher = core::make_ref<core::dispatcher_t>();
 
+  photon::renderer_t renderer{width, height,     window, context,
+                              base,  dispatcher, argv[1]};
+
   auto current_scene = core::make_ref<ecs::scene_t<>>();
   {
     auto id = current_scene->create();
-    current_scene->construct<core::raw_model_t>(id) =
-        core::load_model_from_path(argv[2]);
+    // parsed on the renderer's loader threads, frames keep going meanwhile
+    current_scene->construct<photon::model_source_t>(id).path = argv[2];
     auto &transform = current_scene->construct<core::transform_t>(id);
     transform.scale = {0.01, 0.01, 0.01};
+    dispatcher->post<photon::model_added_event_t>(
+        photon::model_added_event_t{.id = id});
   }
 
-  photon::renderer_t renderer{width, height,     window, context,
-                              base,  dispatcher, argv[1]};
-
   editor_camera_t editor_camera{*window};
   editor_camera.update_projection(float(width) / float(height));
 
@@ -250,9 +252,10 @@ int main(int argc, char **argv) {
           .commit();
     }
     auto size = ImGui::GetContentRegionAvail();
-    if (size.x != width || size.y != height) {
+    if (size.x > 0 && size.y > 0 && (size.x != width || size.y != height)) {
       width = size.x;
       height = size.y;
+      resize = true;
     }
     ImGui::Image(reinterpret_cast<ImTextureID>(reinterpret_cast<void *>(
                      context->get_descriptor_set(imgui_image_descriptor_set)
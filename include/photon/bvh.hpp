@@ -0,0 +1,50 @@
+#ifndef PHOTON_BVH_HPP
+#define PHOTON_BVH_HPP
+
+#include "horizon/core/aabb.hpp"
+#include "horizon/core/bvh.hpp"
+#include "horizon/core/model.hpp"
+#include "photon/thread_pool.hpp"
+#include "photon/types.hpp"
+
+#include <vector>
+
+namespace photon {
+
+// one triangle per 3 indices, primitive index i is triangle i
+std::vector<triangle_t>
+extract_triangles(const std::vector<core::vertex_t> &vertices,
+                  const std::vector<uint32_t> &indices);
+
+/* builds with horizon's binned sah build_bvh2 unless spatial splits or a
+ * parallel build are requested, then photon's own builder is used, both
+ * produce the same node layout (root at 0, children as consecutive pairs)
+ * parallel builds run on pool, or on a temporary pool of
+ * options.thread_count threads when pool is null
+ * */
+core::bvh::bvh_t build_bvh(const std::vector<triangle_t> &triangles,
+                           const bvh_options_t &options,
+                           thread_pool_t *pool = nullptr);
+
+// kensler style tree rotations, swaps a child with a grandchild whenever that
+// shrinks the surface area of the node that changes, bottom up
+void optimize_rotations(core::bvh::bvh_t &bvh, uint32_t passes);
+
+float aabb_area(const core::aabb_t &aabb);
+
+// sah cost of the tree normalized by the surface area of the root, the gpu
+// refit computes the same value in shaders/refit/sah.slang
+float sah_cost(const core::bvh::bvh_t &bvh,
+               const core::bvh::options_t &options);
+
+/* reachable node indices grouped by depth, deepest level first
+ * refit_order[level_offsets[i], level_offsets[i + 1]) is one level, all nodes
+ * of a level can be refitted in parallel once the levels before it are done
+ * */
+void refit_levels(const core::bvh::bvh_t &bvh,
+                  std::vector<uint32_t> &refit_order,
+                  std::vector<uint32_t> &level_offsets);
+
+} // namespace photon
+
+#endif // !PHOTON_BVH_HPP
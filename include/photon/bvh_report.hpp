@@ -0,0 +1,57 @@
+#ifndef PHOTON_BVH_REPORT_HPP
+#define PHOTON_BVH_REPORT_HPP
+
+#include "horizon/core/bvh.hpp"
+#include "photon/types.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace photon {
+
+// quality of a built tree, for tuning bvh_options_t per asset
+struct bvh_report_t {
+  // reachable from the root
+  uint32_t node_count = 0;
+  uint32_t leaf_count = 0;
+  uint32_t primitive_count = 0;
+  // nodes and primitive indices as uploaded
+  size_t bytes = 0;
+  // see sah_cost
+  float sah_cost = 0;
+  /* end point overlap (aila et al. 2013), cost weighted area of the
+   * triangles inside nodes that do not contain them, relative to the total
+   * triangle area, what sah misses about rays entering nodes for nothing
+   * */
+  float epo = 0;
+  // area where the bounds of siblings intersect, summed over inner nodes,
+  // relative to the root
+  float sibling_overlap = 0;
+  uint32_t max_depth = 0;
+  float average_leaf_depth = 0;
+  // leaves per depth and per primitive count, indexed by either
+  std::vector<uint32_t> leaf_depths;
+  std::vector<uint32_t> leaf_sizes;
+};
+
+/* bvh must be built over triangles, primitive index i being triangles[i]
+ * epo clips every triangle against the nodes it overlaps, for large meshes
+ * only epo_samples triangles spread evenly over the mesh, 0 for all of them
+ * */
+bvh_report_t analyze_bvh(const core::bvh::bvh_t &bvh,
+                         const std::vector<triangle_t> &triangles,
+                         const core::bvh::options_t &options,
+                         uint32_t epo_samples = 65536);
+
+// adds report to total, counts and histograms are summed, costs averaged
+// weighted by primitive count, the depth by leaf count
+void merge_bvh_report(bvh_report_t &total, const bvh_report_t &report);
+
+// a single json object
+std::string to_json(const bvh_report_t &report);
+
+} // namespace photon
+
+#endif // !PHOTON_BVH_REPORT_HPP
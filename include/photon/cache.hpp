@@ -0,0 +1,38 @@
+#ifndef PHOTON_CACHE_HPP
+#define PHOTON_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace photon {
+
+// 64 bit fnv-1a, seed chains hashes of several inputs
+uint64_t hash_bytes(const void *data, size_t size,
+                    uint64_t seed = 0xcbf29ce484222325ull);
+
+uint64_t hash_file(const std::filesystem::path &path,
+                   uint64_t seed = 0xcbf29ce484222325ull);
+
+/* flat directory of blobs keyed by a hash
+ * stores go through a temporary file and a rename, so processes sharing the
+ * directory never read a partially written entry
+ * */
+class disk_cache_t {
+public:
+  explicit disk_cache_t(const std::filesystem::path &directory);
+
+  bool load(uint64_t key, std::vector<uint8_t> &data) const;
+  void store(uint64_t key, const void *data, size_t size) const;
+
+private:
+  std::filesystem::path entry_path(uint64_t key) const;
+
+  std::filesystem::path _directory;
+};
+
+} // namespace photon
+
+#endif // !PHOTON_CACHE_HPP
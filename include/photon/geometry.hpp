@@ -0,0 +1,43 @@
+#ifndef PHOTON_GEOMETRY_HPP
+#define PHOTON_GEOMETRY_HPP
+
+#include "horizon/core/model.hpp"
+#include "photon/types.hpp"
+
+#include <vector>
+
+namespace photon {
+
+// bounds of the positions, the quantization step is extent / 65535
+quantization_t quantization(const std::vector<core::vertex_t> &vertices);
+
+compact_vertex_t compact_vertex(const core::vertex_t &vertex,
+                                const quantization_t &quantization);
+
+// position exactly as core.slang decodes it, bvhs of compact meshes are built
+// from these so the nodes bound the triangles that are traced
+core::vec3 decode_position(const compact_vertex_t &vertex,
+                           const quantization_t &quantization);
+
+// ray as ray_data_t::create in core.slang builds it, for trace_rays
+ray_data_t create_ray(const core::vec3 &origin, const core::vec3 &direction,
+                      float tmin = 0.0001f, float tmax = 100000000000000.f);
+
+/* simplifies by vertex clustering, vertices in the same cell of a grid of
+ * cell_size merge into one at their average position with their average
+ * normal, the other attributes are those of the first vertex of the cell
+ * triangles that collapse and duplicates are dropped, no vertex moves
+ * further than a cell diagonal
+ * */
+void cluster_vertices(const std::vector<core::vertex_t> &vertices,
+                      const std::vector<uint32_t> &indices, float cell_size,
+                      std::vector<core::vertex_t> &clustered_vertices,
+                      std::vector<uint32_t> &clustered_indices);
+
+compact_triangle_t compact_triangle(const compact_vertex_t &v0,
+                                    const compact_vertex_t &v1,
+                                    const compact_vertex_t &v2);
+
+} // namespace photon
+
+#endif // !PHOTON_GEOMETRY_HPP
@@ -11,8 +11,25 @@
 #include "horizon/gfx/context.hpp"
 #include "horizon/gfx/types.hpp"
 
+#include "horizon/core/bvh.hpp"
+#include "horizon/core/model.hpp"
+
+#include "photon/bvh_report.hpp"
+#include "photon/shader_cache.hpp"
+#include "photon/thread_pool.hpp"
+#include "photon/types.hpp"
+#include "photon/utils.hpp"
+
 #include <cstdint>
 #include <filesystem>
+#include <future>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 namespace photon {
 
@@ -64,18 +81,185 @@ public:
   renderer_t(uint32_t width, uint32_t height, core::ref<core::window_t> window,
              core::ref<gfx::context_t> context, core::ref<gfx::base_t> base,
              core::ref<core::dispatcher_t> dispatcher,
-             const std::filesystem::path &photon_assets_path);
+             const std::filesystem::path &photon_assets_path,
+             const std::filesystem::path &cache_path = ".photon_cache");
   ~renderer_t();
 
   gfx::handle_image_view_t render(core::ref<ecs::scene_t<>> scene,
                                   const core::camera_t &camera);
 
+  /* traces every camera at width x height in one batch, raygen, trace and
+   * shade each run once over the rays of all views
+   * view i is rows [i * height, (i + 1) * height) of the returned image, in
+   * general layout, no denoising, aovs, upscaling or hybrid visibility
+   * */
+  gfx::handle_image_view_t
+  render_views(core::ref<ecs::scene_t<>> scene,
+               const std::vector<core::camera_t> &cameras, uint32_t width,
+               uint32_t height);
+
+  /* traces arbitrary rays, see create_ray, against the instances of the last
+   * render, on a submission of its own queued behind that frame by the next
+   * render, render_views or wait_ray_queries
+   * the future is fulfilled by a later render, render_views or
+   * wait_ray_queries on this thread, do not block on it before
+   * rays that reach paged out geometry first come back deferred and the
+   * geometry is requested like for camera rays
+   * */
+  std::future<std::vector<hit_t>>
+  trace_rays(const std::vector<ray_data_t> &rays);
+  // records a trace of ray_data_t[count] already on the gpu into hits,
+  // hit_t[count], the caller synchronizes both buffers
+  void cmd_trace_rays(gfx::handle_commandbuffer_t cbuf,
+                      gfx::handle_buffer_t rays, gfx::handle_buffer_t hits,
+                      uint32_t count);
+  // submits the queued trace_rays queries, blocks until they finished and
+  // fulfills the futures, call it outside of a frame
+  void wait_ray_queries() {
+    submit_ray_queries();
+    poll_ray_queries(true);
+  }
+  // entity and mesh index of the instance slot in hit_t::blas_index, slots
+  // move when entities are removed, hit_t::primitive_index is a triangle of
+  // the level of detail the slot traced
+  std::pair<ecs::entity_id_t, uint32_t> instance_owner(uint32_t slot) {
+    return {_instance_owners[slot].id, _instance_owners[slot].mesh_index};
+  }
+
   uint32_t width() { return _width; }
   uint32_t height() { return _height; }
 
   void gui();
 
+  /* tree quality of every mesh, as imported, and of the scene, see
+   * bvh_report_t, only models loaded with model_options_t::bvh_report are
+   * listed, their gpu built meshes with empty reports
+   * {"meshes": [{"entity", "mesh", "report"}, ...], "scene": report}
+   * */
+  void write_bvh_report(const std::filesystem::path &path);
+
+  // aov_bit flags of the aovs shade writes, the aov targets are reallocated
+  // at the start of the next render or render_views
+  void set_aovs(uint32_t aovs) { _requested_aovs = aovs; }
+  uint32_t aovs() { return _requested_aovs; }
+  // general layout, the top left render_width() x render_height() texels
+  // hold the last frame, null while the aov is not written, the denoiser
+  // writes the aovs it needs even when they were not asked for
+  gfx::handle_image_view_t aov_view(aov_t aov) {
+    return _aov_views[uint32_t(aov)];
+  }
+  // temporal reprojection plus a-trous filtering of the render image between
+  // shade and upscale, from the next render on
+  void set_denoise(bool denoise) { _requested_denoise = denoise; }
+  // stores the wavefront rays as compact_ray_t, halving the ray buffers, the
+  // directions lose some precision, the ray buffers are reallocated at the
+  // start of the next render or render_views
+  void set_compact_rays(bool compact_rays) {
+    _requested_compact_rays = compact_rays;
+  }
+
+  // internal resolution of the last frame
+  uint32_t render_width() { return _render_width; }
+  uint32_t render_height() { return _render_height; }
+
+  // replaces the vertices of a deformable mesh (see model_options_t), the bvh
+  // is refitted on the gpu during the next render, indices must not change
+  void update_vertices(ecs::entity_id_t id, uint32_t mesh_index,
+                       std::vector<core::vertex_t> vertices);
+
 private:
+  // adds, removes and moves instances, pages geometry, builds and refits
+  void update_scene(core::ref<ecs::scene_t<>> scene,
+                    gfx::handle_commandbuffer_t cbuf);
+
+  // records and submits the trace_rays queries not submitted yet
+  void submit_ray_queries();
+  // fulfills the trace_rays queries the gpu finished, or all of them
+  void poll_ray_queries(bool wait);
+  // makes gpu writes to a host visible buffer visible to map_buffer reads
+  void invalidate_buffer(gfx::handle_buffer_t buffer);
+  // applies what the setters asked for, before anything of the frame is
+  // recorded, waits for the gpu when targets have to be reallocated
+  void apply_settings();
+
+  // grows the render_views targets, waits for the gpu when it has to
+  void reserve_views(uint32_t width, uint32_t height, uint32_t count);
+  void destroy_views();
+  // bytes per ray in the ray buffers, sizeof compact_ray_t or ray_data_t
+  size_t ray_size() const;
+
+  // output sized
+  void create_images();
+  void destroy_images();
+  // sized for _max_width * _max_height
+  void create_render_targets();
+  void destroy_render_targets();
+  // the enabled aovs, sized like the render targets
+  void create_aov_images();
+  void destroy_aov_images();
+  // reallocates the aov images when _aovs or what denoising needs changed
+  void update_aov_images();
+  // history and filter buffers, sized like the render targets
+  void create_denoise_buffers();
+  void destroy_denoise_buffers();
+  void denoise(gfx::handle_commandbuffer_t cbuf, uint32_t width,
+               uint32_t height);
+  // rasterizes instance slot and primitive index of every pixel into
+  // _visibility_image, viewport placed so samples line up with raygen's rays
+  void rasterize_visibility(gfx::handle_commandbuffer_t cbuf, uint32_t width,
+                            uint32_t height);
+  // adjusts _render_scale from the last gpu timings
+  void update_render_scale();
+
+  // pipeline of shaders/raytracing/<shader>.slang compiled with defines,
+  // created the first time a combination is asked for
+  gfx::handle_pipeline_t
+  permutation_pipeline(const std::string &shader,
+                       gfx::handle_pipeline_layout_t layout,
+                       const shader_defines_t &defines);
+
+  // picks the level of detail of every instance with lods for camera at a
+  // render height of height and rewrites the slots that changed, call it
+  // before upload_instances so the frame's passes see the new levels
+  void select_lods(core::ref<ecs::scene_t<>> scene,
+                   const core::camera_t &camera, uint32_t height);
+
+  void reserve_instances(uint32_t count);
+  // the slot functions only change _instances, upload_instances records the
+  // copy to _instances_buffer into the frame
+  void write_instance(uint32_t slot, const mesh_t &mesh);
+  // rewrites the slots of an entity after its buffers changed
+  void write_instances(ecs::entity_id_t id, const model_t &model);
+  void add_instances(ecs::entity_id_t id, const model_t &model);
+  void remove_instances(ecs::entity_id_t id);
+  // records copies of the matrices of the entities in _dirty_transforms into
+  // their model buffers, through a staging buffer of cbuf
+  void upload_transforms(core::ref<ecs::scene_t<>> scene,
+                         gfx::handle_commandbuffer_t cbuf);
+  // copies _instances to _instances_buffer through a staging buffer of cbuf
+  // when they changed, ahead of every pass that reads the slots
+  void upload_instances(gfx::handle_commandbuffer_t cbuf);
+
+  void refit(core::ref<ecs::scene_t<>> scene, gfx::handle_commandbuffer_t cbuf);
+
+  // reads back the flags trace wrote the last time cbuf was recorded and
+  // points _residency_buffer at the ones of cbuf, before any trace of the
+  // frame is submitted
+  void begin_residency(gfx::handle_commandbuffer_t cbuf);
+  // applies the flags begin_residency read, evicts pageable meshes that were
+  // not hit recently when over budget and pages requested ones in
+  void update_residency(core::ref<ecs::scene_t<>> scene,
+                        gfx::handle_commandbuffer_t cbuf);
+  // zeroes _residency_buffer ahead of the first trace writing it this frame,
+  // later calls only order their trace after that
+  void clear_residency(gfx::handle_commandbuffer_t cbuf);
+
+  // grows _lbvh_scratch_buffer, waits for the gpu when it has to
+  void reserve_lbvh_scratch(uint32_t triangle_count);
+  // records the gpu builds of meshes added with bvh_options_t::gpu_build
+  void build_bvhs(core::ref<ecs::scene_t<>> scene,
+                  gfx::handle_commandbuffer_t cbuf);
+
   const std::filesystem::path _photon_assets_path;
   uint32_t _width, _height;
 
@@ -85,6 +269,12 @@ private:
   core::ref<gfx::context_t> _context;
   core::ref<gfx::base_t> _base;
 
+  // compiled spir-v persists in cache_path / "shaders" between runs
+  shader_cache_t _shader_cache;
+  // block compressed textures in cache_path / "textures", see
+  // model_options_t::texture_compression
+  disk_cache_t _texture_cache;
+
   gfx::handle_image_t _image;
   gfx::handle_image_view_t _image_view;
   gfx::handle_image_t _depth;
@@ -92,28 +282,283 @@ private:
   gfx::handle_image_t _raytrace_image;
   gfx::handle_image_view_t _raytrace_image_view;
 
+  // internal resolution, raygen, trace and shade run at
+  // _render_scale * (_width, _height) and are upscaled into _raytrace_image
+  uint32_t _max_width, _max_height;
+  gfx::handle_image_t _render_image;
+  gfx::handle_image_view_t _render_image_view;
+  bool _dynamic_resolution = false;
+  float _render_scale = 1.f;
+  float _min_render_scale = 0.25f;
+  float _target_frame_time = 16.6f; // ms
+  uint32_t _render_width = 0, _render_height = 0;
+
+  /* primary hits in _hits_buffer stay valid until the camera, the render
+   * resolution, the trace permutation or anything an instance points at
+   * changes, until then frames only rerun shade
+   * */
+  bool _reuse_primary_hits = true;
+  bool _primary_hits_valid = false;
+  bool _last_frame_traced = false;
+  core::mat4 _traced_view, _traced_projection;
+  gfx::handle_pipeline_t _traced_pipeline = core::null_handle;
+
+  uint32_t _aovs = 0;
+  // see set_aovs
+  uint32_t _requested_aovs = 0;
+  // _aovs plus the ones denoising needs, the ones with images
+  uint32_t _active_aovs = 0;
+  gfx::handle_image_t _aov_images[uint32_t(aov_t::e_count)];
+  gfx::handle_image_view_t _aov_views[uint32_t(aov_t::e_count)];
+  // camera of the last frame, for motion vectors
+  core::mat4 _prev_view, _prev_projection;
+  bool _has_prev_camera = false;
+
+  // render_views targets, separate from the single view ones so its batches
+  // do not invalidate reused primary hits
+  uint32_t _views_width = 0, _views_height = 0;
+  uint32_t _views_ray_capacity = 0, _views_camera_capacity = 0;
+  gfx::handle_image_t _views_image = core::null_handle;
+  gfx::handle_image_view_t _views_image_view = core::null_handle;
+  gfx::handle_buffer_t _views_param_buffer;
+  gfx::handle_buffer_t _views_camera_buffer = core::null_handle;
+  gfx::handle_buffer_t _views_ray_data_buffer = core::null_handle;
+  gfx::handle_buffer_t _views_hits_buffer = core::null_handle;
+
+  struct ray_query_t {
+    uint32_t count;
+    gfx::handle_buffer_t rays;
+    // host visible, hit_t[count] then a word the gpu sets once they landed
+    gfx::handle_buffer_t hits;
+    gfx::handle_commandbuffer_t cbuf;
+    // null until submit_ray_queries recorded and submitted it
+    gfx::handle_fence_t fence = core::null_handle;
+    std::promise<std::vector<hit_t>> promise;
+  };
+  void submit_ray_query(ray_query_t &query);
+  std::vector<ray_query_t> _ray_queries;
+  // a single 1, copied behind the hits of a query to mark it done
+  gfx::handle_buffer_t _query_done_buffer;
+
   gfx::handle_pipeline_layout_t _debug_diffuse_pipeline_layout;
   gfx::handle_pipeline_t _debug_diffuse_pipeline;
 
+  // primary hits from a rasterized visibility buffer and resolve.slang
+  // instead of tracing them
+  bool _hybrid_primary = false;
+  gfx::handle_pipeline_layout_t _visibility_pipeline_layout;
+  gfx::handle_pipeline_t _visibility_pipeline;
+  // sized like the render targets
+  gfx::handle_image_t _visibility_image;
+  gfx::handle_image_view_t _visibility_image_view;
+  gfx::handle_image_t _visibility_depth;
+  gfx::handle_image_view_t _visibility_depth_view;
+
   gfx::handle_pipeline_layout_t _raygen_pipeline_layout;
-  gfx::handle_pipeline_t _raygen_pipeline;
+  // raygen, trace and shade keep rays and hits as streams of the fields each
+  // reads instead of ray_data_t and hit_t records, see store_ray in
+  // raytracing/common.slang
+  bool _soa_rays = true;
+  // see set_compact_rays
+  bool _compact_rays = false;
+  bool _requested_compact_rays = false;
 
-  gfx::handle_pipeline_layout_t _trace_pipeline_layout;
-  gfx::handle_pipeline_t _trace_pipeline;
+  // primary rays only trace the instances whose bounds overlap the frustum
+  // and are within _cull_distance, 0 for no limit, secondary rays, ray
+  // queries and render_views see every instance
+  bool _cull_instances = true;
+  float _cull_distance = 0.f;
+  gfx::handle_pipeline_layout_t _cull_pipeline_layout;
+  gfx::handle_pipeline_t _cull_pipeline;
 
+  gfx::handle_pipeline_layout_t _trace_pipeline_layout;
   gfx::handle_pipeline_layout_t _shade_pipeline_layout;
-  gfx::handle_pipeline_t _shade_pipeline;
+  // trace and shade permutations keyed by shader and defines
+  std::map<std::string, gfx::handle_pipeline_t> _permutation_pipelines;
+  // production frames use e_none, which compiles trace without stats
+  debug_view_t _debug_view = debug_view_t::e_none;
+  // 16, 32 or 64, see gui
+  int _stack_size = 16;
+  // subgroup cooperative intersect_blas, compare the trace timer with it on
+  // and off, it pays off on coherent rays
+  bool _wave_traversal = false;
+#ifdef NDEBUG
+  bool _validation = false;
+#else
+  bool _validation = true;
+#endif
+  // coarsest level of detail whose error projects to at most this many
+  // pixels, render_views and ray queries trace the levels render picked
+  float _lod_pixel_error = 1.f;
+  // resident or not, instances whose bvh root is a leaf
+  uint32_t _root_leaf_instances = 0;
+  uint32_t _non_resident_instances = 0;
+
+  gfx::handle_pipeline_layout_t _upscale_pipeline_layout;
+  gfx::handle_pipeline_t _upscale_pipeline;
+
+  gfx::handle_pipeline_layout_t _refit_pipeline_layout;
+  gfx::handle_pipeline_t _refit_triangles_pipeline;
+  gfx::handle_pipeline_t _refit_nodes_pipeline;
+  gfx::handle_pipeline_t _refit_sah_pipeline;
+
+  gfx::handle_pipeline_layout_t _denoise_pipeline_layout;
+  gfx::handle_pipeline_t _denoise_temporal_pipeline;
+  gfx::handle_pipeline_t _denoise_atrous_pipeline;
+  gfx::handle_pipeline_t _denoise_modulate_pipeline;
+  bool _denoise = false;
+  // see set_denoise
+  bool _requested_denoise = false;
+  int _denoise_iterations = 4;
+  int _denoise_max_history = 32;
+  float _denoise_depth_sigma = 0.1f;
+  float _denoise_normal_power = 128.f;
+  float _denoise_luminance_sigma = 4.f;
+  // ping pong, _denoise_history_index is read, the other written
+  gfx::handle_buffer_t _denoise_history[2];
+  gfx::handle_buffer_t _denoise_moments[2];
+  gfx::handle_buffer_t _denoise_filter[2];
+  gfx::handle_buffer_t _denoise_guides = core::null_handle;
+  uint32_t _denoise_history_index = 0;
+  // render resolution the history was accumulated at, 0 when there is none
+  uint32_t _denoise_width = 0, _denoise_height = 0;
+
+  gfx::handle_pipeline_layout_t _lbvh_pipeline_layout;
+  gfx::handle_pipeline_t _lbvh_bounds_pipeline;
+  gfx::handle_pipeline_t _lbvh_morton_pipeline;
+  gfx::handle_pipeline_t _lbvh_histogram_pipeline;
+  gfx::handle_pipeline_t _lbvh_scan_pipeline;
+  gfx::handle_pipeline_t _lbvh_scatter_pipeline;
+  gfx::handle_pipeline_t _lbvh_hierarchy_pipeline;
+  gfx::handle_pipeline_t _lbvh_aabbs_pipeline;
 
   gfx::handle_buffer_t _camera_buffer;
   gfx::handle_buffer_t _param_buffer;
   gfx::handle_buffer_t _ray_data_buffer;
   gfx::handle_buffer_t _hits_buffer;
   gfx::handle_buffer_t _tlas_buffer;
+  // device local, frames in flight keep reading it while the next one is
+  // recorded, so it only changes through copies recorded in a frame
   gfx::handle_buffer_t _instances_buffer = core::null_handle;
+  uint32_t _instances_capacity = 0;
+  bool _instances_dirty = false;
+  // host buffers a frame's recorded copies read from, keyed by the command
+  // buffer, base_t::begin waited for its last submission before handing it
+  // out again so the frame recording into it may overwrite them
+  struct frame_uploads_t {
+    gfx::handle_buffer_t instances = core::null_handle;
+    // mat4 pairs of the entities that moved, see upload_transforms
+    gfx::handle_buffer_t transforms = core::null_handle;
+    // update_vertices data the frame's refits copy into the vertex buffers
+    gfx::handle_buffer_t vertices = core::null_handle;
+    // float per refit, written by refit/sah.slang, read into
+    // mesh_t::refit_sah_cost once the command buffer comes around again
+    gfx::handle_buffer_t sah = core::null_handle;
+    struct sah_readback_t {
+      ecs::entity_id_t id;
+      uint32_t mesh_index;
+      uint32_t index;
+    };
+    std::vector<sah_readback_t> sah_readbacks;
+    // uint32_t[2 * slots], per slot a used and a requested flag written by
+    // trace, for the meshes of residency_owners, see begin_residency
+    gfx::handle_buffer_t residency = core::null_handle;
+    std::vector<std::pair<ecs::entity_id_t, uint32_t>> residency_owners;
+    // replaced while earlier frames may still read them, destroyed by
+    // update_scene once the command buffer comes around again
+    std::vector<gfx::handle_buffer_t> retired;
+    std::vector<model_t> retired_models;
+  };
+  std::map<uint32_t, frame_uploads_t> _frame_uploads;
+  // recreates buffer when it is smaller than cb.vk_size, contents are lost
+  void reserve_buffer(gfx::handle_buffer_t &buffer,
+                      const gfx::config_buffer_t &cb);
+  // forgets the sah costs of id still in flight, its meshes changed
+  void drop_sah_readbacks(ecs::entity_id_t id);
+
+  uint32_t _num_blas_instances = 0;
 
-  uint32_t _num_blas_instances;
+  // frame_uploads_t::residency of the frame being recorded
+  gfx::handle_buffer_t _residency_buffer = core::null_handle;
+  bool _residency_cleared = false;
+  // zeroes, uint32_t[2 * _instances_capacity], copied over the flags
+  gfx::handle_buffer_t _residency_clear_buffer = core::null_handle;
+  struct residency_flags_t {
+    ecs::entity_id_t id;
+    uint32_t mesh_index;
+    uint32_t used, requested;
+  };
+  // read by begin_residency, applied by update_residency
+  std::vector<residency_flags_t> _residency_flags;
+  // uint32_t[1 + _instances_capacity], count then slots, written by cull
+  gfx::handle_buffer_t _visible_instances_buffer = core::null_handle;
+  // counts frames that traced, frames reusing primary hits mark nothing used
+  // and must not age meshes out
+  uint64_t _frame = 0;
+  // pageable geometry kept on the gpu, 0 never evicts
+  int _residency_budget_mb = 0;
+  // frames an unused mesh stays resident before it may be evicted
+  uint32_t _residency_min_age = 8;
+  size_t _resident_geometry_size = 0;
 
-  bool _update_instances_buffer = false;
+  // host mirror of _instances_buffer, kept compact by moving the last slot
+  // into removed ones
+  std::vector<bvh_instance_t> _instances;
+  struct instance_owner_t {
+    ecs::entity_id_t id;
+    uint32_t mesh_index;
+    bool root_is_leaf = false;
+    bool resident = true;
+    // vertices drawn by rasterize_visibility
+    uint32_t index_count = 0;
+    // 0 for the full mesh, i for mesh_t::lods[i - 1]
+    uint32_t lod = 0;
+  };
+  std::vector<instance_owner_t> _instance_owners;
+  // slot of every mesh of an entity, indexed by mesh index
+  std::unordered_map<ecs::entity_id_t, std::vector<uint32_t>> _entity_slots;
+
+  // parses, extracts triangles, builds bvhs and decodes textures of added
+  // models off the render thread, one core is left to it
+  thread_pool_t _loader{std::max(std::thread::hardware_concurrency(), 2u) - 1};
+  struct pending_model_t {
+    ecs::entity_id_t id;
+    std::future<prepared_model_t> model;
+  };
+  std::vector<pending_model_t> _pending_models;
+
+  std::vector<ecs::entity_id_t> _added_entities;
+  std::vector<ecs::entity_id_t> _removed_entities;
+  std::unordered_set<ecs::entity_id_t> _dirty_transforms;
+  // per entity, indexed by mesh index, filled when the model is uploaded
+  std::map<ecs::entity_id_t, std::vector<bvh_report_t>> _bvh_reports;
+
+  struct refit_request_t {
+    ecs::entity_id_t id;
+    uint32_t mesh_index;
+    std::vector<core::vertex_t> vertices;
+  };
+  std::vector<refit_request_t> _refit_requests;
+
+  struct rebuild_t {
+    ecs::entity_id_t id;
+    uint32_t mesh_index;
+    std::future<core::bvh::bvh_t> bvh;
+  };
+  std::vector<rebuild_t> _rebuilds;
+  // a refitted mesh is rebuilt in the background once its sah cost grows past
+  // this factor of the cost it had when it was built
+  float _rebuild_sah_threshold = 1.5f;
+
+  struct bvh_build_request_t {
+    ecs::entity_id_t id;
+    uint32_t mesh_index;
+  };
+  std::vector<bvh_build_request_t> _bvh_build_requests;
+  // sort keys and tree construction state shared by all gpu builds, sized for
+  // the largest mesh built so far
+  gfx::handle_buffer_t _lbvh_scratch_buffer = core::null_handle;
+  uint32_t _lbvh_scratch_capacity = 0;
 
   core::ref<gpu_timer_t> _gpu_timer;
 };
@@ -122,6 +567,28 @@ struct resize_event_t : public core::event_t {
   uint32_t width, height;
 };
 
+/* scene change notifications, the renderer only looks at entities it was told
+ * about and only uploads what changed
+ * */
+
+// entity has a core::raw_model_t or a model_source_t (and optionally a
+// core::transform_t and model_options_t), the model is prepared on loader
+// threads and joins the scene during the first render after it is ready
+struct model_added_event_t : public core::event_t {
+  ecs::entity_id_t id;
+};
+
+// post before destroying the entity, its model_t is removed during the next
+// render
+struct model_removed_event_t : public core::event_t {
+  ecs::entity_id_t id;
+};
+
+// core::transform_t of the entity was modified
+struct transform_changed_event_t : public core::event_t {
+  ecs::entity_id_t id;
+};
+
 } // namespace photon
 
 #endif // !PHOTON_RENDERER_HPP
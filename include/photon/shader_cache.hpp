@@ -0,0 +1,48 @@
+#ifndef PHOTON_SHADER_CACHE_HPP
+#define PHOTON_SHADER_CACHE_HPP
+
+#include "horizon/core/core.hpp"
+#include "horizon/gfx/context.hpp"
+#include "horizon/gfx/types.hpp"
+#include "photon/cache.hpp"
+
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace photon {
+
+// preprocessor defines a shader is compiled with, name and value
+using shader_defines_t = std::vector<std::pair<std::string, std::string>>;
+
+/* compiles slang shaders to spir-v once and keeps the result on disk
+ * entries are keyed by the source of the shader and of every file it
+ * #includes, recursively, so editing core.slang invalidates every shader that
+ * pulls it in, and by the defines, so every permutation is its own entry
+ * a miss compiles through slang and stores the spir-v
+ * */
+class shader_cache_t {
+public:
+  shader_cache_t(core::ref<gfx::context_t> context,
+                 const std::filesystem::path &directory);
+
+  gfx::handle_shader_t create_shader(const std::filesystem::path &path,
+                                     gfx::shader_type_t type,
+                                     const shader_defines_t &defines = {});
+
+private:
+  // hashes path and its includes, each file once
+  uint64_t hash_source(const std::filesystem::path &path, uint64_t hash,
+                       std::vector<std::filesystem::path> &visited);
+  bool compile(const std::filesystem::path &path, gfx::shader_type_t type,
+               const shader_defines_t &defines, std::vector<uint32_t> &spirv);
+
+  core::ref<gfx::context_t> _context;
+  std::filesystem::path _directory;
+  disk_cache_t _disk_cache;
+};
+
+} // namespace photon
+
+#endif // !PHOTON_SHADER_CACHE_HPP
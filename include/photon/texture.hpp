@@ -0,0 +1,49 @@
+#ifndef PHOTON_TEXTURE_HPP
+#define PHOTON_TEXTURE_HPP
+
+#include "horizon/core/core.hpp"
+#include "horizon/gfx/base.hpp"
+#include "horizon/gfx/types.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace photon {
+
+// rgba8 pixels of one mip level, or its blocks, see compress_mips
+struct mip_level_t {
+  uint32_t width, height;
+  std::vector<uint8_t> pixels;
+};
+
+// number of levels of a full chain down to 1x1
+uint32_t mip_count(uint32_t width, uint32_t height);
+
+/* full mip chain of an rgba8 image, level 0 is the image itself
+ * every level is a 2x2 box filter of the previous one, averaged in linear
+ * space when srgb is set, odd sizes clamp the last row and column
+ * */
+std::vector<mip_level_t> generate_mips(uint32_t width, uint32_t height,
+                                       const uint8_t *pixels, bool srgb);
+
+// decodes path to rgba8 and generates its mips, no gpu work so it can run on
+// loader threads, empty when the file could not be read
+std::vector<mip_level_t> load_mips(const std::filesystem::path &path,
+                                   bool srgb);
+
+// uploads every level, the image is left in
+// VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+gfx::handle_image_t upload_mips(core::ref<gfx::base_t> base,
+                                const std::vector<mip_level_t> &levels,
+                                VkFormat format, const std::string &debug_name);
+
+// like gfx::helper::load_image_from_path_instant but with the full mip chain
+gfx::handle_image_t load_image_with_mips(core::ref<gfx::base_t> base,
+                                         const std::filesystem::path &path,
+                                         VkFormat format);
+
+} // namespace photon
+
+#endif // !PHOTON_TEXTURE_HPP
@@ -0,0 +1,40 @@
+#ifndef PHOTON_TEXTURE_COMPRESSION_HPP
+#define PHOTON_TEXTURE_COMPRESSION_HPP
+
+#include "photon/cache.hpp"
+#include "photon/texture.hpp"
+#include "photon/thread_pool.hpp"
+#include "photon/types.hpp"
+
+#include <filesystem>
+#include <vector>
+
+namespace photon {
+
+// vulkan format of compressed levels, VK_FORMAT_R8G8B8A8_* for e_none
+VkFormat compressed_format(texture_compression_t compression, bool srgb);
+
+/* encodes rgba8 levels to 4x4 blocks, the pixels of every returned level
+ * hold its blocks row by row, ready for upload_mips, edge blocks of sizes
+ * that are not a multiple of 4 repeat the last row and column
+ *   e_bc1  4 color mode, endpoints along the principal axis of the block
+ *   e_bc7  mode 6 only, a single rgba subset with 4 bit indices
+ * rows of blocks are spread over pool when given
+ * */
+std::vector<mip_level_t> compress_mips(const std::vector<mip_level_t> &levels,
+                                       texture_compression_t compression,
+                                       thread_pool_t *pool = nullptr);
+
+/* load_mips followed by compress_mips, cache holds the results keyed by the
+ * source bytes and the settings so later loads skip decoding and encoding
+ * empty when the file could not be read
+ * */
+std::vector<mip_level_t>
+load_compressed_mips(const std::filesystem::path &path, bool srgb,
+                     texture_compression_t compression,
+                     const disk_cache_t *cache = nullptr,
+                     thread_pool_t *pool = nullptr);
+
+} // namespace photon
+
+#endif // !PHOTON_TEXTURE_COMPRESSION_HPP
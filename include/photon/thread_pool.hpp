@@ -0,0 +1,80 @@
+#ifndef PHOTON_THREAD_POOL_HPP
+#define PHOTON_THREAD_POOL_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace photon {
+
+/* work stealing thread pool
+ * every worker owns a deque, tasks submitted from a worker go to the back of
+ * its own deque and are popped from there (lifo, cache friendly), idle workers
+ * steal from the front of the other deques
+ * */
+class thread_pool_t {
+public:
+  // 0 uses std::thread::hardware_concurrency
+  explicit thread_pool_t(uint32_t thread_count = 0);
+  ~thread_pool_t();
+
+  thread_pool_t(const thread_pool_t &) = delete;
+  thread_pool_t &operator=(const thread_pool_t &) = delete;
+
+  uint32_t size() const { return _threads.size(); }
+
+  template <typename fn_t>
+  auto submit(fn_t &&fn) -> std::future<std::invoke_result_t<fn_t>> {
+    using result_t = std::invoke_result_t<fn_t>;
+    auto task = std::make_shared<std::packaged_task<result_t()>>(
+        std::forward<fn_t>(fn));
+    std::future<result_t> future = task->get_future();
+    push([task]() { (*task)(); });
+    return future;
+  }
+
+  // runs other tasks while waiting, so tasks may wait on tasks they submitted
+  // without starving the pool
+  template <typename result_t> result_t wait(std::future<result_t> &future) {
+    while (future.wait_for(std::chrono::seconds(0)) !=
+           std::future_status::ready) {
+      if (!run_one())
+        std::this_thread::yield();
+    }
+    return future.get();
+  }
+
+private:
+  struct queue_t {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  void push(std::function<void()> task);
+  bool pop(uint32_t index, std::function<void()> &task);
+  bool steal(uint32_t index, std::function<void()> &task);
+  // pops or steals a single task and runs it, false if there was none
+  bool run_one();
+  void worker(uint32_t index);
+
+  std::vector<std::unique_ptr<queue_t>> _queues;
+  std::vector<std::thread> _threads;
+  std::atomic<uint32_t> _next_queue{0};
+  std::atomic<uint32_t> _pending{0};
+  std::mutex _mutex;
+  std::condition_variable _condition;
+  bool _stop = false;
+};
+
+} // namespace photon
+
+#endif // !PHOTON_THREAD_POOL_HPP
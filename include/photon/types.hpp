@@ -12,10 +12,51 @@
 #include "horizon/gfx/types.hpp"
 #include "imgui.h"
 
+#include <cstdint>
 #include <vector>
 
 namespace photon {
 
+// bindless storage image slots, must match common.slang
+static constexpr uint32_t output_storage_image = 0;
+static constexpr uint32_t render_storage_image = 1;
+
+/* arbitrary output variables, written by shade next to the color at the
+ * render resolution, aov i lives in bindless storage image
+ * aov_storage_image + i, only enabled ones are allocated and written
+ *   e_depth   r32f, view space depth
+ *   e_normal  rgba16f, world space shading normal
+ *   e_albedo  rgba8, diffuse texture
+ *   e_motion  rg16f, uv now minus uv last frame, camera motion only
+ *   e_ids     rg32ui, instance slot and primitive index
+ * */
+enum class aov_t : uint32_t {
+  e_depth = 0,
+  e_normal = 1,
+  e_albedo = 2,
+  e_motion = 3,
+  e_ids = 4,
+  e_count = 5,
+};
+static constexpr uint32_t aov_storage_image = 2;
+
+constexpr uint32_t aov_bit(aov_t aov) { return 1u << uint32_t(aov); }
+
+// rg32ui instance slot and primitive index per pixel, rasterized when
+// primary visibility is hybrid, must match common.slang
+static constexpr uint32_t visibility_storage_image =
+    aov_storage_image + uint32_t(aov_t::e_count);
+// the views of renderer_t::render_views stacked vertically
+static constexpr uint32_t views_storage_image = visibility_storage_image + 1;
+
+// what shade writes, must match DEBUG_VIEW_* in shaders/raytracing/common.slang
+// heatmaps compile trace with intersection counting
+enum class debug_view_t : uint32_t {
+  e_none = 0,
+  e_node_heatmap = 1,
+  e_primitive_heatmap = 2,
+};
+
 struct material_t {
   gfx::handle_image_t diffuse;
   gfx::handle_image_view_t diffuse_view;
@@ -27,6 +68,9 @@ struct camera_t {
   core::mat4 inv_view;
   core::mat4 projection;
   core::mat4 inv_projection;
+  // last frame, for motion vectors
+  core::mat4 prev_view;
+  core::mat4 prev_projection;
 };
 
 struct triangle_t {
@@ -37,6 +81,64 @@ struct triangle_t {
   core::vec3 center() const { return (v0 + v1 + v2) / 3.f; }
 };
 
+/* compact geometry, see model_options_t::compact_geometry
+ * positions are 16 bit unorm relative to the mesh bounds, normals and tangents
+ * octahedral 16 bit snorm, uvs half floats, 20 bytes instead of the 56 of
+ * core::vertex_t, decoded in core.slang
+ * */
+struct compact_vertex_t {
+  uint32_t position_xy;
+  uint32_t position_z; // bit 31 set when the bi_tangent is flipped
+  uint32_t normal;
+  uint32_t tangent;
+  uint32_t uv;
+};
+
+// the 9 quantized positions of a triangle, x0 y0 z0 x1 ... 16 bits each,
+// 20 bytes instead of the 36 of triangle_t
+struct compact_triangle_t {
+  uint32_t positions[5];
+};
+
+// position = min + quantized position * scale
+struct quantization_t {
+  core::vec3 min{};
+  core::vec3 scale{};
+};
+
+struct bvh_options_t {
+  core::bvh::options_t options{
+      .o_min_primitive_count = 1,
+      .o_max_primitive_count = 8,
+      .o_object_split_search_type =
+          core::bvh::object_split_search_type_t::e_binned_sah,
+      .o_primitive_intersection_cost = 1.1f,
+      .o_node_intersection_cost = 1.f,
+      .o_samples = 8,
+  };
+  // sbvh style spatial splits, a triangle can end up in more than one leaf,
+  // pays off for long thin and large overlapping triangles
+  bool spatial_splits = false;
+  // spatial splits are only searched when the children of the best object
+  // split overlap by more than this fraction of the root surface area
+  float spatial_split_alpha = 1e-5f;
+  // extra triangle references spatial splits may add, fraction of triangles
+  float duplication_budget = 0.25f;
+  // tree rotation passes run on the finished tree
+  uint32_t rotation_passes = 0;
+  // bins and partitions the top levels on a thread pool and builds the
+  // subtrees below them as independent tasks, for meshes with millions of
+  // triangles, the tree does not depend on the thread count unless spatial
+  // splits run out of duplication budget
+  bool parallel = false;
+  // threads of the temporary pool used when no pool is passed, 0 uses all
+  uint32_t thread_count = 0;
+  // linear bvh built by the renderer on the gpu from the uploaded vertices,
+  // no cpu build or second upload, one triangle per leaf, the options above
+  // are ignored, deformable meshes always build on the cpu
+  bool gpu_build = false;
+};
+
 /*
  * Not required
 struct triangle_indices_t {
@@ -44,6 +146,33 @@ struct triangle_indices_t {
 };
 */
 
+// host copy of the gpu geometry of a pageable mesh, byte for byte
+struct host_geometry_t {
+  std::vector<uint8_t> vertices;
+  std::vector<uint8_t> indices;
+  std::vector<uint8_t> nodes;
+  std::vector<uint8_t> primitive_indices;
+  std::vector<uint8_t> bvh_triangles;
+
+  size_t size() const {
+    return vertices.size() + indices.size() + nodes.size() +
+           primitive_indices.size() + bvh_triangles.size();
+  }
+};
+
+// a coarser level of detail of a mesh, full precision and always resident
+struct mesh_lod_t {
+  gfx::handle_buffer_t vertex_buffer;
+  gfx::handle_buffer_t index_buffer;
+  gfx::handle_buffer_t nodes_buffer;
+  gfx::handle_buffer_t primitive_index_buffer;
+  gfx::handle_buffer_t bvh_triangles_buffer;
+  uint32_t index_count;
+  bool root_is_leaf;
+  // object space distance the surface may be off from the full mesh
+  float error;
+};
+
 struct mesh_t {
   gfx::handle_buffer_t vertex_buffer;
   gfx::handle_buffer_t index_buffer;
@@ -67,19 +196,61 @@ struct mesh_t {
   uint32_t vertex_count;
   uint32_t index_count;
 
+  // refit, only created for deformable meshes
+  bool deformable = false;
+  // node indices, deepest level first, see refit_levels
+  gfx::handle_buffer_t refit_order_buffer = core::null_handle;
+  std::vector<uint32_t> refit_level_offsets;
+  // sah cost of the last gpu refit the host read back, a few frames old
+  float refit_sah_cost = 0;
+  // options the bvh was built with, reused by refits and rebuilds
+  bvh_options_t bvh_options;
+  // sah cost of the tree when it was last built
+  float build_sah_cost = 0;
+  // single leaf bvh, trace needs the PHOTON_ROOT_LEAF path for it
+  bool root_is_leaf = false;
+  // vertex_buffer holds compact_vertex_t and bvh_triangles_buffer
+  // compact_triangle_t
+  bool compact_geometry = false;
+  quantization_t quantization;
+  // object space bounds, stay resident while the geometry is paged out
+  core::aabb_t aabb;
+  // out of core, only filled for pageable meshes, the vertex, index, nodes,
+  // primitive index and bvh triangle buffers are null while not resident
+  host_geometry_t host_geometry;
+  bool resident = true;
+  uint64_t last_used_frame = 0;
+  // host copies, used for background rebuilds
+  std::vector<core::vertex_t> vertices;
+  std::vector<uint32_t> indices;
+  // lods[i] is level i + 1, coarser and with a larger error than level i,
+  // see model_options_t::lod_levels
+  std::vector<mesh_lod_t> lods;
+
   core::ref<gfx::context_t> context;
 
   mesh_t() { context = nullptr; }
 
   ~mesh_t() {
     if (context != nullptr) {
-      context->destroy_buffer(vertex_buffer);
-      context->destroy_buffer(index_buffer);
-      context->destroy_buffer(nodes_buffer);
-      context->destroy_buffer(primitive_index_buffer);
-      context->destroy_buffer(bvh_triangles_buffer);
+      if (resident) {
+        context->destroy_buffer(vertex_buffer);
+        context->destroy_buffer(index_buffer);
+        context->destroy_buffer(nodes_buffer);
+        context->destroy_buffer(primitive_index_buffer);
+        context->destroy_buffer(bvh_triangles_buffer);
+      }
       context->destroy_buffer(model_buffer);
       context->destroy_buffer(inv_model_buffer);
+      if (refit_order_buffer != core::null_handle)
+        context->destroy_buffer(refit_order_buffer);
+      for (auto &lod : lods) {
+        context->destroy_buffer(lod.vertex_buffer);
+        context->destroy_buffer(lod.index_buffer);
+        context->destroy_buffer(lod.nodes_buffer);
+        context->destroy_buffer(lod.primitive_index_buffer);
+        context->destroy_buffer(lod.bvh_triangles_buffer);
+      }
       context->destroy_image_view(material.diffuse_view);
       context->destroy_image(material.diffuse);
     }
@@ -99,6 +270,22 @@ struct mesh_t {
     material = other.material;
     vertex_count = other.vertex_count;
     index_count = other.index_count;
+    deformable = other.deformable;
+    refit_order_buffer = other.refit_order_buffer;
+    refit_level_offsets = std::move(other.refit_level_offsets);
+    refit_sah_cost = other.refit_sah_cost;
+    bvh_options = other.bvh_options;
+    build_sah_cost = other.build_sah_cost;
+    root_is_leaf = other.root_is_leaf;
+    compact_geometry = other.compact_geometry;
+    quantization = other.quantization;
+    aabb = other.aabb;
+    host_geometry = std::move(other.host_geometry);
+    resident = other.resident;
+    last_used_frame = other.last_used_frame;
+    vertices = std::move(other.vertices);
+    indices = std::move(other.indices);
+    lods = std::move(other.lods);
     context = other.context;
 
     other.vertex_buffer = core::null_handle;
@@ -108,6 +295,7 @@ struct mesh_t {
     other.bvh_triangles_buffer = core::null_handle;
     other.model_buffer = core::null_handle;
     other.inv_model_buffer = core::null_handle;
+    other.refit_order_buffer = core::null_handle;
     other.context = 0;
   }
 
@@ -122,6 +310,22 @@ struct mesh_t {
     material = other.material;
     vertex_count = other.vertex_count;
     index_count = other.index_count;
+    deformable = other.deformable;
+    refit_order_buffer = other.refit_order_buffer;
+    refit_level_offsets = std::move(other.refit_level_offsets);
+    refit_sah_cost = other.refit_sah_cost;
+    bvh_options = other.bvh_options;
+    build_sah_cost = other.build_sah_cost;
+    root_is_leaf = other.root_is_leaf;
+    compact_geometry = other.compact_geometry;
+    quantization = other.quantization;
+    aabb = other.aabb;
+    host_geometry = std::move(other.host_geometry);
+    resident = other.resident;
+    last_used_frame = other.last_used_frame;
+    vertices = std::move(other.vertices);
+    indices = std::move(other.indices);
+    lods = std::move(other.lods);
     context = other.context;
 
     other.vertex_buffer = core::null_handle;
@@ -131,6 +335,7 @@ struct mesh_t {
     other.bvh_triangles_buffer = core::null_handle;
     other.model_buffer = core::null_handle;
     other.inv_model_buffer = core::null_handle;
+    other.refit_order_buffer = core::null_handle;
     other.context = 0;
 
     return *this;
@@ -151,6 +356,18 @@ struct ray_data_t {
   core::vec3 inv_direction;
   float tmin, tmax;
   uint32_t pixel_index;
+  // ray cone, footprint width at the origin and its growth per unit distance
+  float cone_width, cone_spread;
+};
+
+// 32 byte ray, written and read only by the shaders, see raytracing/core.slang
+struct compact_ray_t {
+  core::vec3 origin;
+  float tmin;
+  uint32_t direction; // octahedral, snorm16 x 2, normalized
+  float tmax;
+  uint32_t pixel_flags; // pixel index in the low 28 bits, flags above
+  uint32_t cone;        // half cone_width, half cone_spread
 };
 
 // changes between frames and changes between bounces
@@ -184,6 +401,17 @@ struct bvh_instance_t {
   core::mat4 *inv_model;
 
   gfx::handle_bindless_image_t diffuse_bindless;
+
+  // set instead of vertices and bvh_triangles for compact meshes
+  uint32_t compact_geometry;
+  compact_vertex_t *compact_vertices;
+  compact_triangle_t *compact_triangles;
+  quantization_t quantization;
+
+  // object space bounds, rays that miss them skip the blas
+  core::aabb_t aabb;
+  // 0 while the geometry is paged out, only aabb is valid then
+  uint32_t resident;
 };
 
 struct hit_t {
@@ -192,24 +420,153 @@ struct hit_t {
   uint32_t primitive_index = core::bvh::invalid_index;
   float t = core::infinity;
   float u = 0, v = 0, w = 0;
+  uint32_t node_intersection_count = 0;
+  uint32_t primitive_intersection_count = 0;
+  // a closer non resident instance was in the way, retried once paged in
+  uint32_t deferred = 0;
+};
+
+struct push_constant_visibility_t {
+  camera_t *camera;
+  bvh_instance_t *instances;
+  uint32_t instance; // slot drawn
 };
 
 struct push_constant_raytracing_t {
   uint32_t width;
   uint32_t height;
-  ray_data_t *ray_data;              // ray_data_t[width * height]
-  camera_t *camera;                  // camera_t
+  // ray_data_t[width * height * views], streams with PHOTON_SOA,
+  // compact_ray_t with PHOTON_COMPACT_RAYS
+  ray_data_t *ray_data;
+  camera_t *camera;                  // camera_t[views]
   current_raytracing_param_t *param; // current_raytracing_param_t
   bvh_t *tlas;                       // bvh_t
   uint32_t num_blas_instances;       //
   bvh_instance_t *instances;         //
-  hit_t *hits;                       // hit_t[width * height]
+  hit_t *hits;                       // like ray_data
+  uint32_t *residency; // uint32_t[2 * num_blas_instances], used, requested
+  // view v is rows [v * height, (v + 1) * height) of the rays and of target,
+  // 0 for ray queries, trace then reads width rays and no param
+  uint32_t views;
+  uint32_t target; // storage image shade writes
+  // count then slots, written by cull.slang, read by trace with PHOTON_CULLING
+  uint32_t *visible_instances;
+};
+
+struct push_constant_cull_t {
+  camera_t *camera;
+  bvh_instance_t *instances;
+  uint32_t num_blas_instances;
+  uint32_t *visible_instances; // uint32_t[1 + num_blas_instances]
+  float max_distance;          // from the camera, 0 keeps distant instances
+};
+
+struct push_constant_upscale_t {
+  uint32_t src_width; // of render_storage_image
+  uint32_t src_height;
+  uint32_t dst_width; // of output_storage_image
+  uint32_t dst_height;
+};
+
+struct push_constant_denoise_t {
+  uint32_t *history_in; // rgba16f pairs, illumination and history length
+  uint32_t *history_out;
+  float *moments_in;    // luminance and luminance squared per pixel
+  float *moments_out;
+  uint32_t *filter_in;  // rgba16f pairs, illumination and variance
+  uint32_t *filter_out;
+  float *guides;        // depth and normal of the last frame per pixel
+  uint32_t width;       // render resolution
+  uint32_t height;
+  uint32_t step;        // a-trous tap spacing
+  uint32_t max_history;
+  uint32_t reset;       // ignore the history, set after resizes
+  float depth_sigma;    // relative to the depth
+  float normal_power;
+  float luminance_sigma; // in standard deviations
+};
+
+struct push_constant_refit_t {
+  core::vertex_t *vertices;
+  uint32_t *indices;
+  triangle_t *bvh_triangles;
+  core::bvh::node_t *nodes;
+  uint32_t *primitive_indices;
+  uint32_t *refit_order; // uint32_t[count]
+  float *sah;            // float
+  uint32_t offset;       // first refit_order entry of the dispatch
+  uint32_t count;        // triangles, nodes of a level or all nodes
+  float node_intersection_cost;
+  float primitive_intersection_cost;
+};
+
+// keys sorted per radix sort workgroup, must match lbvh/common.slang
+static constexpr uint32_t lbvh_block_size = 4096;
+
+struct push_constant_lbvh_t {
+  triangle_t *bvh_triangles;
+  core::bvh::node_t *nodes;
+  uint32_t *primitive_indices;
+  float *bounds;              // centroid bounds, min xyz then max xyz
+  uint32_t *keys_in;          // morton codes
+  uint32_t *values_in;        // triangle indices
+  uint32_t *keys_out;
+  uint32_t *values_out;
+  uint32_t *block_histograms; // uint32_t[256 * block_count], digit major
+  uint32_t *parents;          // parent of internal node i
+  uint32_t *leaf_parents;     // parent of leaf i
+  uint32_t *internal_slots;   // node index internal node i is stored at
+  uint32_t *counters;         // children finished, per internal node
+  uint32_t count;             // triangles
+  uint32_t block_count;       // radix sort blocks
+  uint32_t shift;             // first bit of the radix sort digit
 };
 
 struct model_t {
   std::vector<mesh_t> meshes;
 };
 
+// optional component, read when a core::raw_model_t is first uploaded
+// in place of a core::raw_model_t, the file is parsed on loader threads
+struct model_source_t {
+  std::filesystem::path path;
+};
+
+/* block compression of the textures of a model, see texture_compression.hpp
+ *   e_none  rgba8
+ *   e_bc1   4 bits per texel, rgb only, alpha is dropped
+ *   e_bc7   8 bits per texel, rgba
+ * */
+enum class texture_compression_t : uint32_t {
+  e_none = 0,
+  e_bc1 = 1,
+  e_bc7 = 2,
+};
+
+struct model_options_t {
+  // vertices can be replaced and the bvh is refitted on the gpu after
+  // renderer_t::update_vertices instead of being rebuilt
+  bool deformable = false;
+  // used for every mesh of the model
+  bvh_options_t bvh_options;
+  // quantized vertices and triangles, see compact_vertex_t, ignored for
+  // deformable meshes and gpu bvh builds which need full precision vertices
+  bool compact_geometry = false;
+  // keeps a host copy of the geometry so the renderer can evict it when over
+  // its residency budget, ignored for deformable meshes and gpu bvh builds
+  bool pageable = false;
+  // coarser levels of detail generated by vertex clustering, each with its
+  // own bvh, the renderer traces the coarsest one whose error stays below a
+  // pixel, ignored for deformable, compact and pageable meshes and gpu bvh
+  // builds, levels that would barely drop triangles are skipped
+  uint32_t lod_levels = 0;
+  // transcoded on the loader threads, cached on disk by the renderer
+  texture_compression_t texture_compression = texture_compression_t::e_none;
+  // analyzes every cpu built bvh while loading, see analyze_bvh, for
+  // renderer_t::write_bvh_report, slow for large meshes
+  bool bvh_report = false;
+};
+
 } // namespace photon
 
 #endif // !PHOTON_TYPES_HPP
@@ -1,14 +1,90 @@
 #ifndef PHOTON_UTILS
 #define PHOTON_UTILS
 
+#include "horizon/core/bvh.hpp"
 #include "horizon/core/model.hpp"
+#include "photon/bvh_report.hpp"
+#include "photon/cache.hpp"
+#include "photon/texture.hpp"
+#include "photon/thread_pool.hpp"
 #include "photon/types.hpp"
 
+#include <filesystem>
+#include <vector>
+
 namespace photon {
 
+struct prepared_lod_t {
+  std::vector<core::vertex_t> vertices;
+  std::vector<uint32_t> indices;
+  std::vector<triangle_t> triangles;
+  core::bvh::bvh_t bvh;
+  float error;
+};
+
+// everything raw_model_to_model computes on the host for a mesh before it
+// touches the gpu
+struct prepared_mesh_t {
+  bvh_options_t bvh_options;
+  bool deformable = false;
+  bool compact_geometry = false;
+  bool pageable = false;
+  std::vector<core::vertex_t> vertices;
+  std::vector<uint32_t> indices;
+  // only for compact geometry
+  quantization_t quantization;
+  std::vector<compact_vertex_t> compact_vertices;
+  std::vector<compact_triangle_t> compact_triangles;
+  core::aabb_t aabb;
+  // empty for gpu builds
+  std::vector<triangle_t> triangles;
+  core::bvh::bvh_t bvh;
+  // of bvh, empty for gpu builds and without model_options_t::bvh_report
+  bvh_report_t bvh_report;
+  std::filesystem::path diffuse_path;
+  // empty when the texture could not be decoded, horizon loads it instead
+  std::vector<mip_level_t> diffuse_mips;
+  // of diffuse_mips, see model_options_t::texture_compression
+  VkFormat diffuse_format = VK_FORMAT_R8G8B8A8_SRGB;
+  // coarser levels, see model_options_t::lod_levels
+  std::vector<prepared_lod_t> lods;
+};
+
+struct prepared_model_t {
+  std::vector<prepared_mesh_t> meshes;
+  // see model_options_t::bvh_report
+  bool bvh_report = false;
+};
+
+// file parsing aside, the slow part of loading a model, touches no gpu state
+// so it runs on loader threads, parallel bvh builds and texture compression
+// use pool, compressed textures are looked up in and added to texture_cache
+prepared_model_t prepare_model(const core::raw_model_t &raw_model,
+                               const std::filesystem::path &photon_assets_path,
+                               const model_options_t &options,
+                               thread_pool_t *pool = nullptr,
+                               const disk_cache_t *texture_cache = nullptr);
+
+// creates and fills the gpu buffers and textures, render thread only
+model_t upload_model(core::ref<gfx::base_t> base, prepared_model_t &&prepared);
+
+// prepare_model and upload_model in one go
 model_t raw_model_to_model(core::ref<gfx::base_t> base,
                            const std::filesystem::path &photon_assets_path,
-                           const core::raw_model_t &raw_model);
+                           const core::raw_model_t &raw_model,
+                           const model_options_t &options = {});
+
+// (re)uploads nodes, primitive indices and refit data of a built bvh, the
+// previous nodes, primitive index and refit order buffers are not destroyed
+void upload_bvh(core::ref<gfx::base_t> base, mesh_t &mesh,
+                const core::bvh::bvh_t &bvh);
+
+// takes the gpu geometry of a pageable mesh, the host copy is kept, the
+// returned buffers are destroyed by the caller once the gpu is done with them
+std::vector<gfx::handle_buffer_t> evict_geometry(mesh_t &mesh);
+
+// uploads the host copy of an evicted mesh again
+void page_in_geometry(core::ref<gfx::base_t> base, mesh_t &mesh);
 
 } // namespace photon
 
@@ -0,0 +1,725 @@
+#include "photon/bvh.hpp"
+
+#include "horizon/core/aabb.hpp"
+#include "horizon/core/bvh.hpp"
+#include "horizon/core/math.hpp"
+#include "photon/thread_pool.hpp"
+#include "photon/types.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <memory>
+
+namespace photon {
+
+std::vector<triangle_t>
+extract_triangles(const std::vector<core::vertex_t> &vertices,
+                  const std::vector<uint32_t> &indices) {
+  std::vector<triangle_t> triangles{};
+  triangles.reserve(indices.size() / 3);
+  for (uint32_t i = 0; i < indices.size(); i += 3) {
+    triangle_t triangle{
+        .v0 = vertices[indices[i + 0]].position,
+        .v1 = vertices[indices[i + 1]].position,
+        .v2 = vertices[indices[i + 2]].position,
+    };
+    triangles.push_back(triangle);
+  }
+  return triangles;
+}
+
+namespace {
+
+struct reference_t {
+  core::aabb_t aabb;
+  uint32_t primitive_index;
+};
+
+bool aabb_empty(const core::aabb_t &aabb) {
+  return aabb.min.x > aabb.max.x || aabb.min.y > aabb.max.y ||
+         aabb.min.z > aabb.max.z;
+}
+
+core::aabb_t aabb_union(const core::aabb_t &a, const core::aabb_t &b) {
+  core::aabb_t aabb{};
+  aabb.min = core::min(a.min, b.min);
+  aabb.max = core::max(a.max, b.max);
+  return aabb;
+}
+
+core::aabb_t aabb_intersection(const core::aabb_t &a, const core::aabb_t &b) {
+  core::aabb_t aabb{};
+  aabb.min = core::max(a.min, b.min);
+  aabb.max = core::min(a.max, b.max);
+  return aabb;
+}
+
+// bounds of the part of the triangle between lo and hi along axis, clamped to
+// bounds since the reference may already be a clipped piece of the triangle
+core::aabb_t clip_triangle(const triangle_t &triangle, uint32_t axis, float lo,
+                           float hi, const core::aabb_t &bounds) {
+  const core::vec3 v[3] = {triangle.v0, triangle.v1, triangle.v2};
+  core::aabb_t aabb{};
+  for (uint32_t i = 0; i < 3; i++) {
+    const core::vec3 &a = v[i];
+    const core::vec3 &b = v[(i + 1) % 3];
+    if (a[axis] >= lo && a[axis] <= hi)
+      aabb.grow(a);
+    for (float plane : {lo, hi}) {
+      if ((a[axis] < plane && b[axis] > plane) ||
+          (a[axis] > plane && b[axis] < plane)) {
+        float t = (plane - a[axis]) / (b[axis] - a[axis]);
+        core::vec3 p = a + (b - a) * t;
+        p[axis] = plane;
+        aabb.grow(p);
+      }
+    }
+  }
+  return aabb_intersection(aabb, bounds);
+}
+
+// state shared by the top level builder and the subtree builders it spawns
+struct build_context_t {
+  const std::vector<triangle_t> &triangles;
+  const bvh_options_t &options;
+  float root_area = 0;
+  thread_pool_t *pool = nullptr;
+  // nodes with at most this many references are built by a single task
+  uint32_t subtree_size = 0;
+};
+
+// nodes with fewer references are binned and partitioned on one thread
+constexpr uint32_t parallel_binning_size = 1u << 15;
+// lower bound on the size of a subtree task, keeps the tasks coarse
+constexpr uint32_t min_subtree_size = 1u << 12;
+
+/* binned sah builder with optional sbvh style spatial splits
+ * the top level builder bins and partitions large nodes on the pool and hands
+ * nodes below context.subtree_size to subtree builders running as pool tasks,
+ * the subtrees are appended in the order they were spawned and duplicate
+ * out of a slice of the spatial split budget handed to them at spawn, so the
+ * node order does not depend on scheduling, short of a parallel partition
+ * that runs past the duplicates its binning predicted
+ * */
+class builder_t {
+public:
+  builder_t(build_context_t &context, bool top_level,
+            uint32_t duplication_budget)
+      : _context(context), _options(context.options),
+        _top_level(top_level && context.pool),
+        _duplication_budget(duplication_budget) {}
+
+  core::bvh::bvh_t build(std::vector<reference_t> references) {
+    _bvh.nodes.emplace_back();
+    build_node(0, std::move(references));
+    for (auto &subtree : _subtrees) {
+      core::bvh::bvh_t bvh = _context.pool->wait(subtree.bvh);
+      append_subtree(subtree.node_index, bvh);
+    }
+    _subtrees.clear();
+    return std::move(_bvh);
+  }
+
+private:
+  struct split_t {
+    float cost = core::infinity;
+    uint32_t axis = 0;
+    float position = 0;
+    uint32_t left_count = 0, right_count = 0;
+    core::aabb_t left{}, right{};
+  };
+
+  struct bin_t {
+    core::aabb_t aabb{};
+    uint32_t count = 0; // object splits: references, spatial splits: entries
+    uint32_t exits = 0;
+  };
+
+  struct subtree_t {
+    uint32_t node_index;
+    std::future<core::bvh::bvh_t> bvh;
+  };
+
+  float split_cost(float node_area, const core::aabb_t &left,
+                   uint32_t left_count, const core::aabb_t &right,
+                   uint32_t right_count) const {
+    const core::bvh::options_t &o = _options.options;
+    return o.o_node_intersection_cost +
+           o.o_primitive_intersection_cost *
+               (aabb_area(left) * left_count +
+                aabb_area(right) * right_count) /
+               node_area;
+  }
+
+  uint32_t bin_count() const {
+    return std::max<uint32_t>(_options.options.o_samples, 2);
+  }
+
+  uint32_t chunk_count(uint32_t count) const {
+    if (!_top_level || count < parallel_binning_size)
+      return 1;
+    return _context.pool->size();
+  }
+
+  // runs fn(chunk, begin, end) over chunk_count(count) ranges of [0, count)
+  template <typename fn_t> void for_chunks(uint32_t count, fn_t &&fn) const {
+    const uint32_t chunks = chunk_count(count);
+    if (chunks == 1) {
+      fn(0u, 0u, count);
+      return;
+    }
+    std::vector<std::future<void>> futures{};
+    for (uint32_t chunk = 0; chunk < chunks; chunk++) {
+      uint32_t begin = uint64_t(count) * chunk / chunks;
+      uint32_t end = uint64_t(count) * (chunk + 1) / chunks;
+      futures.push_back(_context.pool->submit(
+          [&fn, chunk, begin, end]() { fn(chunk, begin, end); }));
+    }
+    for (auto &future : futures)
+      _context.pool->wait(future);
+  }
+
+  // bins of all three axes, per chunk, reduced into chunk 0
+  std::vector<bin_t>
+  merge_bins(std::vector<std::vector<bin_t>> &chunk_bins) const {
+    std::vector<bin_t> &bins = chunk_bins[0];
+    for (uint32_t chunk = 1; chunk < chunk_bins.size(); chunk++) {
+      for (uint32_t b = 0; b < bins.size(); b++) {
+        bins[b].aabb = aabb_union(bins[b].aabb, chunk_bins[chunk][b].aabb);
+        bins[b].count += chunk_bins[chunk][b].count;
+        bins[b].exits += chunk_bins[chunk][b].exits;
+      }
+    }
+    return std::move(bins);
+  }
+
+  // sweeps the bins of one axis, spatial bins count exits on the right side
+  void sweep(const bin_t *bins, uint32_t axis, float min, float bin_size,
+             bool spatial, float node_area, split_t &best) const {
+    const uint32_t bins_per_axis = bin_count();
+    std::vector<core::aabb_t> right_aabbs(bins_per_axis);
+    std::vector<uint32_t> right_counts(bins_per_axis);
+    core::aabb_t right{};
+    uint32_t right_count = 0;
+    for (uint32_t i = bins_per_axis - 1; i > 0; i--) {
+      right = aabb_union(right, bins[i].aabb);
+      right_count += spatial ? bins[i].exits : bins[i].count;
+      right_aabbs[i] = right;
+      right_counts[i] = right_count;
+    }
+    core::aabb_t left{};
+    uint32_t left_count = 0;
+    for (uint32_t i = 0; i + 1 < bins_per_axis; i++) {
+      left = aabb_union(left, bins[i].aabb);
+      left_count += bins[i].count;
+      if (left_count == 0 || right_counts[i + 1] == 0)
+        continue;
+      float cost = split_cost(node_area, left, left_count, right_aabbs[i + 1],
+                              right_counts[i + 1]);
+      if (cost < best.cost) {
+        best.cost = cost;
+        best.axis = axis;
+        best.position = min + bin_size * float(i + 1);
+        best.left_count = left_count;
+        best.right_count = right_counts[i + 1];
+        best.left = left;
+        best.right = right_aabbs[i + 1];
+      }
+    }
+  }
+
+  split_t find_object_split(const std::vector<reference_t> &references,
+                            float node_area) const {
+    const uint32_t count = references.size();
+    const uint32_t chunks = chunk_count(count);
+    const uint32_t bins_per_axis = bin_count();
+
+    std::vector<core::aabb_t> chunk_bounds(chunks);
+    for_chunks(count, [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+      for (uint32_t i = begin; i < end; i++)
+        chunk_bounds[chunk].grow(
+            (references[i].aabb.min + references[i].aabb.max) * 0.5f);
+    });
+    core::aabb_t centroid_bounds{};
+    for (auto &bounds : chunk_bounds)
+      centroid_bounds = aabb_union(centroid_bounds, bounds);
+    const core::vec3 extent = centroid_bounds.max - centroid_bounds.min;
+
+    std::vector<std::vector<bin_t>> chunk_bins(
+        chunks, std::vector<bin_t>(3 * bins_per_axis));
+    for_chunks(count, [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+      std::vector<bin_t> &bins = chunk_bins[chunk];
+      for (uint32_t i = begin; i < end; i++) {
+        const reference_t &reference = references[i];
+        for (uint32_t axis = 0; axis < 3; axis++) {
+          if (extent[axis] <= 0)
+            continue;
+          float center =
+              (reference.aabb.min[axis] + reference.aabb.max[axis]) * 0.5f;
+          float t = (center - centroid_bounds.min[axis]) / extent[axis];
+          uint32_t b = std::min<uint32_t>(bins_per_axis - 1,
+                                          uint32_t(t * bins_per_axis));
+          bin_t &bin = bins[axis * bins_per_axis + b];
+          bin.aabb = aabb_union(bin.aabb, reference.aabb);
+          bin.count++;
+        }
+      }
+    });
+    const std::vector<bin_t> bins = merge_bins(chunk_bins);
+
+    split_t best{};
+    for (uint32_t axis = 0; axis < 3; axis++) {
+      if (extent[axis] <= 0)
+        continue;
+      sweep(bins.data() + axis * bins_per_axis, axis,
+            centroid_bounds.min[axis], extent[axis] / bins_per_axis, false,
+            node_area, best);
+    }
+    return best;
+  }
+
+  split_t find_spatial_split(const std::vector<reference_t> &references,
+                             const core::aabb_t &node_aabb,
+                             float node_area) const {
+    const uint32_t count = references.size();
+    const uint32_t bins_per_axis = bin_count();
+    const core::vec3 extent = node_aabb.max - node_aabb.min;
+
+    std::vector<std::vector<bin_t>> chunk_bins(
+        chunk_count(count), std::vector<bin_t>(3 * bins_per_axis));
+    for_chunks(count, [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+      for (uint32_t axis = 0; axis < 3; axis++) {
+        if (extent[axis] <= 0)
+          continue;
+        const float min = node_aabb.min[axis];
+        const float bin_size = extent[axis] / bins_per_axis;
+        auto bin_of = [&](float p) {
+          float t = std::max(0.f, (p - min) / extent[axis]);
+          return std::min<uint32_t>(bins_per_axis - 1,
+                                    uint32_t(t * bins_per_axis));
+        };
+        bin_t *bins = chunk_bins[chunk].data() + axis * bins_per_axis;
+        for (uint32_t i = begin; i < end; i++) {
+          const reference_t &reference = references[i];
+          uint32_t first = bin_of(reference.aabb.min[axis]);
+          uint32_t last = bin_of(reference.aabb.max[axis]);
+          const triangle_t &triangle =
+              _context.triangles[reference.primitive_index];
+          for (uint32_t b = first; b <= last; b++) {
+            float lo = min + bin_size * b;
+            float hi =
+                b == bins_per_axis - 1 ? node_aabb.max[axis] : lo + bin_size;
+            core::aabb_t chopped =
+                clip_triangle(triangle, axis, lo, hi, reference.aabb);
+            if (!aabb_empty(chopped))
+              bins[b].aabb = aabb_union(bins[b].aabb, chopped);
+          }
+          bins[first].count++;
+          bins[last].exits++;
+        }
+      }
+    });
+    const std::vector<bin_t> bins = merge_bins(chunk_bins);
+
+    split_t best{};
+    for (uint32_t axis = 0; axis < 3; axis++) {
+      if (extent[axis] <= 0)
+        continue;
+      sweep(bins.data() + axis * bins_per_axis, axis, node_aabb.min[axis],
+            extent[axis] / bins_per_axis, true, node_area, best);
+    }
+    return best;
+  }
+
+  // claims count references from budget, all or none of them
+  static bool take(std::atomic<uint32_t> &budget, uint32_t count) {
+    uint32_t available = budget.load();
+    while (available >= count &&
+           !budget.compare_exchange_weak(available, available - count)) {
+    }
+    return available >= count;
+  }
+
+  /* sorts one reference to the left and or right side of the split
+   * duplicates come out of reserved, what build_node claimed for the split,
+   * then out of the shared budget, with neither left the reference goes to
+   * one side whole like in an object split
+   * */
+  void partition(const reference_t &reference, const split_t &split,
+                 bool spatial, std::atomic<uint32_t> &reserved,
+                 std::vector<reference_t> &left,
+                 std::vector<reference_t> &right) {
+    if (!spatial) {
+      float center =
+          (reference.aabb.min[split.axis] + reference.aabb.max[split.axis]) *
+          0.5f;
+      if (center < split.position)
+        left.push_back(reference);
+      else
+        right.push_back(reference);
+      return;
+    }
+    if (reference.aabb.max[split.axis] <= split.position) {
+      left.push_back(reference);
+      return;
+    }
+    if (reference.aabb.min[split.axis] >= split.position) {
+      right.push_back(reference);
+      return;
+    }
+    const triangle_t &triangle = _context.triangles[reference.primitive_index];
+    core::aabb_t left_aabb = clip_triangle(
+        triangle, split.axis, -core::infinity, split.position, reference.aabb);
+    core::aabb_t right_aabb = clip_triangle(
+        triangle, split.axis, split.position, core::infinity, reference.aabb);
+    if (aabb_empty(left_aabb)) {
+      right.push_back(reference);
+    } else if (aabb_empty(right_aabb)) {
+      left.push_back(reference);
+    } else if (take(reserved, 1) || take(_duplication_budget, 1)) {
+      left.push_back(reference_t{.aabb = left_aabb,
+                                 .primitive_index = reference.primitive_index});
+      right.push_back(reference_t{
+          .aabb = right_aabb, .primitive_index = reference.primitive_index});
+    } else {
+      partition(reference, split, false, reserved, left, right);
+    }
+  }
+
+  void make_leaf(uint32_t node_index,
+                 const std::vector<reference_t> &references,
+                 const core::aabb_t &aabb) {
+    core::bvh::node_t &node = _bvh.nodes[node_index];
+    node.aabb = aabb;
+    node.is_leaf = 1;
+    node.primitive_count = references.size();
+    node.first_primitive_index_or_child_index = _bvh.primitive_indices.size();
+    for (auto &reference : references)
+      _bvh.primitive_indices.push_back(reference.primitive_index);
+  }
+
+  // moves a subtree built with its root at 0 into node_index, the rest of its
+  // nodes and its primitive indices are appended
+  void append_subtree(uint32_t node_index, const core::bvh::bvh_t &subtree) {
+    const uint32_t node_offset = _bvh.nodes.size() - 1;
+    const uint32_t primitive_offset = _bvh.primitive_indices.size();
+    auto relocate = [&](core::bvh::node_t node) {
+      node.first_primitive_index_or_child_index +=
+          node.is_leaf ? primitive_offset : node_offset;
+      return node;
+    };
+    _bvh.nodes[node_index] = relocate(subtree.nodes[0]);
+    for (uint32_t i = 1; i < subtree.nodes.size(); i++)
+      _bvh.nodes.push_back(relocate(subtree.nodes[i]));
+    _bvh.primitive_indices.insert(_bvh.primitive_indices.end(),
+                                  subtree.primitive_indices.begin(),
+                                  subtree.primitive_indices.end());
+  }
+
+  void build_node(uint32_t node_index, std::vector<reference_t> references) {
+    const uint32_t count = references.size();
+    if (_top_level && count <= _context.subtree_size) {
+      build_context_t &context = _context;
+      // taken here on the top level thread, in spawn order
+      const uint32_t budget = std::min<uint32_t>(
+          _duplication_budget.load(),
+          uint32_t(float(count) * _options.duplication_budget));
+      _duplication_budget -= budget;
+      _subtrees.push_back(subtree_t{
+          .node_index = node_index,
+          .bvh = _context.pool->submit(
+              [&context, budget, references = std::move(references)]() mutable {
+                return builder_t{context, false, budget}.build(
+                    std::move(references));
+              }),
+      });
+      return;
+    }
+
+    std::vector<core::aabb_t> chunk_aabbs(chunk_count(count));
+    for_chunks(count, [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+      for (uint32_t i = begin; i < end; i++)
+        chunk_aabbs[chunk] =
+            aabb_union(chunk_aabbs[chunk], references[i].aabb);
+    });
+    core::aabb_t aabb{};
+    for (auto &chunk_aabb : chunk_aabbs)
+      aabb = aabb_union(aabb, chunk_aabb);
+
+    const core::bvh::options_t &o = _options.options;
+    if (count <= o.o_min_primitive_count) {
+      make_leaf(node_index, references, aabb);
+      return;
+    }
+
+    const float node_area = std::max(aabb_area(aabb), 1e-20f);
+    split_t split = find_object_split(references, node_area);
+    bool spatial = false;
+    // claimed up front, parallel subtrees share the budget
+    std::atomic<uint32_t> reserved{0};
+    if (_options.spatial_splits && _duplication_budget.load() > 0 &&
+        split.cost != core::infinity) {
+      core::aabb_t overlap = aabb_intersection(split.left, split.right);
+      if (!aabb_empty(overlap) &&
+          aabb_area(overlap) >
+              _options.spatial_split_alpha * _context.root_area) {
+        split_t spatial_split = find_spatial_split(references, aabb, node_area);
+        uint32_t duplicates =
+            spatial_split.left_count + spatial_split.right_count - count;
+        if (spatial_split.cost < split.cost &&
+            take(_duplication_budget, duplicates)) {
+          split = spatial_split;
+          spatial = true;
+          reserved = duplicates;
+        }
+      }
+    }
+
+    const float leaf_cost = count * o.o_primitive_intersection_cost;
+    if (count <= o.o_max_primitive_count && leaf_cost <= split.cost) {
+      _duplication_budget += reserved.load();
+      make_leaf(node_index, references, aabb);
+      return;
+    }
+
+    std::vector<reference_t> left{}, right{};
+    if (split.cost == core::infinity) {
+      // all centroids coincide, split the references in half
+      left.assign(references.begin(), references.begin() + count / 2);
+      right.assign(references.begin() + count / 2, references.end());
+    } else {
+      // chunks are concatenated in order, same result as a serial partition
+      const uint32_t chunks = chunk_count(count);
+      std::vector<std::vector<reference_t>> chunk_left(chunks);
+      std::vector<std::vector<reference_t>> chunk_right(chunks);
+      for_chunks(count, [&](uint32_t chunk, uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++)
+          partition(references[i], split, spatial, reserved,
+                    chunk_left[chunk], chunk_right[chunk]);
+      });
+      if (chunks == 1) {
+        left = std::move(chunk_left[0]);
+        right = std::move(chunk_right[0]);
+      } else {
+        for (uint32_t chunk = 0; chunk < chunks; chunk++) {
+          left.insert(left.end(), chunk_left[chunk].begin(),
+                      chunk_left[chunk].end());
+          right.insert(right.end(), chunk_right[chunk].begin(),
+                       chunk_right[chunk].end());
+        }
+      }
+    }
+    // clipping can leave some of the claimed duplicates unused
+    _duplication_budget += reserved.load();
+    if (left.empty() || right.empty()) {
+      // floating point disagreement between binning and partitioning
+      std::vector<reference_t> all = left.empty() ? right : left;
+      left.assign(all.begin(), all.begin() + all.size() / 2);
+      right.assign(all.begin() + all.size() / 2, all.end());
+    }
+    references.clear();
+    references.shrink_to_fit();
+
+    const uint32_t first_child = _bvh.nodes.size();
+    _bvh.nodes.emplace_back();
+    _bvh.nodes.emplace_back();
+    {
+      core::bvh::node_t &node = _bvh.nodes[node_index];
+      node.aabb = aabb;
+      node.is_leaf = 0;
+      node.primitive_count = 0;
+      node.first_primitive_index_or_child_index = first_child;
+    }
+    build_node(first_child + 0, std::move(left));
+    build_node(first_child + 1, std::move(right));
+  }
+
+  build_context_t &_context;
+  const bvh_options_t &_options;
+  const bool _top_level;
+  // duplicates spatial splits may still add, shared by parallel partitions
+  std::atomic<uint32_t> _duplication_budget;
+  core::bvh::bvh_t _bvh;
+  std::vector<subtree_t> _subtrees;
+};
+
+core::bvh::bvh_t build_photon_bvh(const std::vector<triangle_t> &triangles,
+                                  const bvh_options_t &options,
+                                  thread_pool_t *pool) {
+  build_context_t context{.triangles = triangles, .options = options};
+
+  std::unique_ptr<thread_pool_t> local_pool{};
+  if (options.parallel && !pool) {
+    local_pool = std::make_unique<thread_pool_t>(options.thread_count);
+    pool = local_pool.get();
+  }
+  if (options.parallel) {
+    context.pool = pool;
+    // a handful of tasks per thread so stealing can even out uneven subtrees
+    context.subtree_size = std::max<uint32_t>(
+        min_subtree_size, triangles.size() / (pool->size() * 16));
+  }
+
+  std::vector<reference_t> references(triangles.size());
+  core::aabb_t root{};
+  for (uint32_t i = 0; i < triangles.size(); i++) {
+    references[i] =
+        reference_t{.aabb = triangles[i].aabb(), .primitive_index = i};
+    root = aabb_union(root, references[i].aabb);
+  }
+  context.root_area = aabb_area(root);
+
+  return builder_t{context, true,
+                   uint32_t(float(triangles.size()) *
+                            options.duplication_budget)}
+      .build(std::move(references));
+}
+
+} // namespace
+
+core::bvh::bvh_t build_bvh(const std::vector<triangle_t> &triangles,
+                           const bvh_options_t &options, thread_pool_t *pool) {
+  core::bvh::bvh_t bvh{};
+  if (triangles.empty()) {
+    core::bvh::node_t &root = bvh.nodes.emplace_back();
+    root.is_leaf = 1;
+    root.primitive_count = 0;
+    root.first_primitive_index_or_child_index = 0;
+    return bvh;
+  }
+  if (options.spatial_splits || options.parallel) {
+    bvh = build_photon_bvh(triangles, options, pool);
+  } else {
+    std::vector<core::aabb_t> aabbs{};
+    std::vector<core::vec3> centers{};
+    aabbs.reserve(triangles.size());
+    centers.reserve(triangles.size());
+    for (auto &triangle : triangles) {
+      aabbs.push_back(triangle.aabb());
+      centers.push_back(triangle.center());
+    }
+    bvh = core::bvh::build_bvh2(aabbs.data(), centers.data(), triangles.size(),
+                                options.options);
+  }
+  if (options.rotation_passes)
+    optimize_rotations(bvh, options.rotation_passes);
+  return bvh;
+}
+
+void optimize_rotations(core::bvh::bvh_t &bvh, uint32_t passes) {
+  std::vector<uint32_t> refit_order{};
+  std::vector<uint32_t> level_offsets{};
+  for (uint32_t pass = 0; pass < passes; pass++) {
+    refit_levels(bvh, refit_order, level_offsets);
+    uint32_t rotations = 0;
+    for (uint32_t node_index : refit_order) {
+      const core::bvh::node_t node = bvh.nodes[node_index];
+      if (node.is_leaf)
+        continue;
+      const uint32_t l = node.first_primitive_index_or_child_index;
+      const uint32_t r = l + 1;
+
+      // largest surface area reduction of the child that receives a sibling
+      float best_area = 0;
+      uint32_t best_swap_a = 0, best_swap_b = 0, best_parent = 0;
+      auto consider = [&](uint32_t sibling, uint32_t parent) {
+        if (bvh.nodes[parent].is_leaf)
+          return;
+        const uint32_t c =
+            bvh.nodes[parent].first_primitive_index_or_child_index;
+        for (uint32_t i = 0; i < 2; i++) {
+          // swap sibling with grandchild c + i, parent keeps c + 1 - i
+          float area = aabb_area(
+              aabb_union(bvh.nodes[sibling].aabb, bvh.nodes[c + 1 - i].aabb));
+          float reduction = aabb_area(bvh.nodes[parent].aabb) - area;
+          if (reduction > best_area) {
+            best_area = reduction;
+            best_swap_a = sibling;
+            best_swap_b = c + i;
+            best_parent = parent;
+          }
+        }
+      };
+      consider(l, r);
+      consider(r, l);
+      if (best_area <= 0)
+        continue;
+
+      std::swap(bvh.nodes[best_swap_a], bvh.nodes[best_swap_b]);
+      const uint32_t c =
+          bvh.nodes[best_parent].first_primitive_index_or_child_index;
+      bvh.nodes[best_parent].aabb =
+          aabb_union(bvh.nodes[c + 0].aabb, bvh.nodes[c + 1].aabb);
+      rotations++;
+    }
+    if (rotations == 0)
+      break;
+  }
+}
+
+float aabb_area(const core::aabb_t &aabb) {
+  core::vec3 e = aabb.max - aabb.min;
+  if (e.x < 0 || e.y < 0 || e.z < 0)
+    return 0;
+  return 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+}
+
+float sah_cost(const core::bvh::bvh_t &bvh,
+               const core::bvh::options_t &options) {
+  if (bvh.nodes.empty())
+    return 0;
+  float root_area = aabb_area(bvh.nodes[0].aabb);
+  if (root_area <= 0)
+    return 0;
+
+  std::vector<uint32_t> refit_order{};
+  std::vector<uint32_t> level_offsets{};
+  refit_levels(bvh, refit_order, level_offsets);
+
+  float cost = 0;
+  for (uint32_t node_index : refit_order) {
+    const core::bvh::node_t &node = bvh.nodes[node_index];
+    float area = aabb_area(node.aabb) / root_area;
+    if (node.is_leaf)
+      cost += area * node.primitive_count *
+              options.o_primitive_intersection_cost;
+    else
+      cost += area * options.o_node_intersection_cost;
+  }
+  return cost;
+}
+
+void refit_levels(const core::bvh::bvh_t &bvh,
+                  std::vector<uint32_t> &refit_order,
+                  std::vector<uint32_t> &level_offsets) {
+  refit_order.clear();
+  level_offsets.clear();
+  if (bvh.nodes.empty())
+    return;
+
+  std::vector<std::vector<uint32_t>> levels{{0}};
+  while (true) {
+    std::vector<uint32_t> next{};
+    for (uint32_t node_index : levels.back()) {
+      const core::bvh::node_t &node = bvh.nodes[node_index];
+      if (node.is_leaf)
+        continue;
+      // children are always stored as a consecutive pair
+      next.push_back(node.first_primitive_index_or_child_index + 0);
+      next.push_back(node.first_primitive_index_or_child_index + 1);
+    }
+    if (next.empty())
+      break;
+    levels.push_back(std::move(next));
+  }
+
+  std::reverse(levels.begin(), levels.end());
+  for (auto &level : levels) {
+    level_offsets.push_back(refit_order.size());
+    refit_order.insert(refit_order.end(), level.begin(), level.end());
+  }
+  level_offsets.push_back(refit_order.size());
+}
+
+} // namespace photon
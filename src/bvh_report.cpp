@@ -0,0 +1,235 @@
+#include "photon/bvh_report.hpp"
+
+#include "horizon/core/aabb.hpp"
+#include "horizon/core/bvh.hpp"
+#include "horizon/core/math.hpp"
+#include "photon/bvh.hpp"
+
+#include <algorithm>
+#include <array>
+#include <sstream>
+
+namespace photon {
+
+namespace {
+
+// triangles clipped by the 6 planes of a box have at most 9 corners
+using polygon_t = std::array<core::vec3, 9>;
+
+// sutherland hodgman against the plane keeping side * p[axis] <= side * value
+uint32_t clip(const polygon_t &in, uint32_t count, polygon_t &out,
+              uint32_t axis, float value, float side) {
+  uint32_t out_count = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    const core::vec3 &a = in[i];
+    const core::vec3 &b = in[(i + 1) % count];
+    const float da = side * (a[axis] - value);
+    const float db = side * (b[axis] - value);
+    if (da <= 0)
+      out[out_count++] = a;
+    if ((da < 0 && db > 0) || (da > 0 && db < 0))
+      out[out_count++] = a + (b - a) * (da / (da - db));
+  }
+  return out_count;
+}
+
+float polygon_area(const polygon_t &polygon, uint32_t count) {
+  core::vec3 sum{0.f};
+  for (uint32_t i = 1; i + 1 < count; i++)
+    sum += core::cross(polygon[i] - polygon[0], polygon[i + 1] - polygon[0]);
+  return 0.5f * core::length(sum);
+}
+
+float triangle_area(const triangle_t &triangle) {
+  polygon_t polygon{triangle.v0, triangle.v1, triangle.v2};
+  return polygon_area(polygon, 3);
+}
+
+// area of the part of triangle inside aabb
+float clipped_area(const triangle_t &triangle, const core::aabb_t &aabb) {
+  polygon_t a{triangle.v0, triangle.v1, triangle.v2};
+  polygon_t b{};
+  uint32_t count = 3;
+  for (uint32_t axis = 0; axis < 3 && count; axis++) {
+    count = clip(a, count, b, axis, aabb.min[axis], -1.f);
+    count = clip(b, count, a, axis, aabb.max[axis], 1.f);
+  }
+  return count < 3 ? 0.f : polygon_area(a, count);
+}
+
+bool overlaps(const core::aabb_t &a, const core::aabb_t &b) {
+  return a.min.x <= b.max.x && b.min.x <= a.max.x && a.min.y <= b.max.y &&
+         b.min.y <= a.max.y && a.min.z <= b.max.z && b.min.z <= a.max.z;
+}
+
+core::aabb_t intersection(const core::aabb_t &a, const core::aabb_t &b) {
+  core::aabb_t result{};
+  result.min = core::max(a.min, b.min);
+  result.max = core::min(a.max, b.max);
+  return result;
+}
+
+template <typename T>
+void write_array(std::ostringstream &json, const std::vector<T> &values) {
+  json << "[";
+  for (size_t i = 0; i < values.size(); i++)
+    json << (i ? ", " : "") << values[i];
+  json << "]";
+}
+
+} // namespace
+
+bvh_report_t analyze_bvh(const core::bvh::bvh_t &bvh,
+                         const std::vector<triangle_t> &triangles,
+                         const core::bvh::options_t &options,
+                         uint32_t epo_samples) {
+  bvh_report_t report{};
+  if (bvh.nodes.empty())
+    return report;
+  report.bytes = bvh.nodes.size() * sizeof(core::bvh::node_t) +
+                 bvh.primitive_indices.size() * sizeof(uint32_t);
+  report.sah_cost = sah_cost(bvh, options);
+  const float root_area = aabb_area(bvh.nodes[0].aabb);
+
+  // parents and the leaf of every primitive, for the epo ancestor test
+  std::vector<uint32_t> parents(bvh.nodes.size(), core::bvh::invalid_index);
+  std::vector<uint32_t> primitive_leaves(triangles.size(),
+                                         core::bvh::invalid_index);
+  uint64_t leaf_depth_sum = 0;
+  std::vector<std::pair<uint32_t, uint32_t>> stack{{0, 0}};
+  while (!stack.empty()) {
+    auto [node_index, depth] = stack.back();
+    stack.pop_back();
+    const core::bvh::node_t &node = bvh.nodes[node_index];
+    report.node_count++;
+    report.max_depth = std::max(report.max_depth, depth);
+    if (node.is_leaf) {
+      report.leaf_count++;
+      report.primitive_count += node.primitive_count;
+      leaf_depth_sum += depth;
+      if (report.leaf_depths.size() <= depth)
+        report.leaf_depths.resize(depth + 1);
+      report.leaf_depths[depth]++;
+      if (report.leaf_sizes.size() <= node.primitive_count)
+        report.leaf_sizes.resize(node.primitive_count + 1);
+      report.leaf_sizes[node.primitive_count]++;
+      for (uint32_t i = 0; i < node.primitive_count; i++) {
+        const uint32_t primitive =
+            bvh.primitive_indices[node.first_primitive_index_or_child_index +
+                                  i];
+        if (primitive < primitive_leaves.size())
+          primitive_leaves[primitive] = node_index;
+      }
+      continue;
+    }
+    // children are always stored as a consecutive pair
+    const uint32_t left = node.first_primitive_index_or_child_index;
+    if (root_area > 0)
+      report.sibling_overlap +=
+          aabb_area(intersection(bvh.nodes[left].aabb,
+                                 bvh.nodes[left + 1].aabb)) /
+          root_area;
+    for (uint32_t child : {left, left + 1}) {
+      parents[child] = node_index;
+      stack.push_back({child, depth + 1});
+    }
+  }
+  if (report.leaf_count)
+    report.average_leaf_depth = float(leaf_depth_sum) / report.leaf_count;
+
+  const uint32_t stride =
+      epo_samples && triangles.size() > epo_samples
+          ? uint32_t((triangles.size() + epo_samples - 1) / epo_samples)
+          : 1;
+  double total_area = 0, overlap_cost = 0;
+  std::vector<uint32_t> ancestors{};
+  std::vector<uint32_t> nodes{};
+  for (uint32_t t = 0; t < triangles.size(); t += stride) {
+    const triangle_t &triangle = triangles[t];
+    const core::aabb_t bounds = triangle.aabb();
+    total_area += triangle_area(triangle);
+    ancestors.clear();
+    for (uint32_t n = primitive_leaves[t]; n != core::bvh::invalid_index;
+         n = parents[n])
+      ancestors.push_back(n);
+
+    nodes.assign({0});
+    while (!nodes.empty()) {
+      const uint32_t node_index = nodes.back();
+      nodes.pop_back();
+      const core::bvh::node_t &node = bvh.nodes[node_index];
+      if (!overlaps(bounds, node.aabb))
+        continue;
+      if (std::find(ancestors.begin(), ancestors.end(), node_index) ==
+          ancestors.end()) {
+        const float cost =
+            node.is_leaf
+                ? options.o_primitive_intersection_cost * node.primitive_count
+                : options.o_node_intersection_cost;
+        overlap_cost += cost * clipped_area(triangle, node.aabb);
+      }
+      if (!node.is_leaf) {
+        nodes.push_back(node.first_primitive_index_or_child_index);
+        nodes.push_back(node.first_primitive_index_or_child_index + 1);
+      }
+    }
+  }
+  if (total_area > 0)
+    report.epo = float(overlap_cost / total_area);
+  return report;
+}
+
+void merge_bvh_report(bvh_report_t &total, const bvh_report_t &report) {
+  const uint32_t primitives = total.primitive_count + report.primitive_count;
+  auto weighted = [&](float a, float b) {
+    return primitives ? (a * total.primitive_count +
+                         b * report.primitive_count) /
+                            primitives
+                      : 0.f;
+  };
+  total.sah_cost = weighted(total.sah_cost, report.sah_cost);
+  total.epo = weighted(total.epo, report.epo);
+  total.sibling_overlap =
+      weighted(total.sibling_overlap, report.sibling_overlap);
+  const uint32_t leaves = total.leaf_count + report.leaf_count;
+  if (leaves)
+    total.average_leaf_depth =
+        (total.average_leaf_depth * total.leaf_count +
+         report.average_leaf_depth * report.leaf_count) /
+        leaves;
+
+  total.node_count += report.node_count;
+  total.leaf_count = leaves;
+  total.primitive_count = primitives;
+  total.bytes += report.bytes;
+  total.max_depth = std::max(total.max_depth, report.max_depth);
+  auto add = [](std::vector<uint32_t> &a, const std::vector<uint32_t> &b) {
+    if (a.size() < b.size())
+      a.resize(b.size());
+    for (size_t i = 0; i < b.size(); i++)
+      a[i] += b[i];
+  };
+  add(total.leaf_depths, report.leaf_depths);
+  add(total.leaf_sizes, report.leaf_sizes);
+}
+
+std::string to_json(const bvh_report_t &report) {
+  std::ostringstream json{};
+  json << "{\"node_count\": " << report.node_count
+       << ", \"leaf_count\": " << report.leaf_count
+       << ", \"primitive_count\": " << report.primitive_count
+       << ", \"bytes\": " << report.bytes
+       << ", \"sah_cost\": " << report.sah_cost
+       << ", \"epo\": " << report.epo
+       << ", \"sibling_overlap\": " << report.sibling_overlap
+       << ", \"max_depth\": " << report.max_depth
+       << ", \"average_leaf_depth\": " << report.average_leaf_depth
+       << ", \"leaf_depths\": ";
+  write_array(json, report.leaf_depths);
+  json << ", \"leaf_sizes\": ";
+  write_array(json, report.leaf_sizes);
+  json << "}";
+  return json.str();
+}
+
+} // namespace photon
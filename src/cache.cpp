@@ -0,0 +1,77 @@
+#include "photon/cache.hpp"
+
+#include "horizon/core/logger.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <system_error>
+
+namespace photon {
+
+uint64_t hash_bytes(const void *data, size_t size, uint64_t seed) {
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data);
+  uint64_t hash = seed;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+uint64_t hash_file(const std::filesystem::path &path, uint64_t seed) {
+  std::ifstream file{path, std::ios::binary};
+  std::vector<char> bytes{std::istreambuf_iterator<char>(file),
+                          std::istreambuf_iterator<char>()};
+  return hash_bytes(bytes.data(), bytes.size(), seed);
+}
+
+disk_cache_t::disk_cache_t(const std::filesystem::path &directory)
+    : _directory(directory) {
+  std::error_code error;
+  std::filesystem::create_directories(_directory, error);
+  if (error)
+    horizon_warn("failed to create cache directory {}: {}",
+                 _directory.string(), error.message());
+}
+
+std::filesystem::path disk_cache_t::entry_path(uint64_t key) const {
+  char name[17];
+  std::snprintf(name, sizeof(name), "%016llx",
+                static_cast<unsigned long long>(key));
+  return _directory / name;
+}
+
+bool disk_cache_t::load(uint64_t key, std::vector<uint8_t> &data) const {
+  std::ifstream file{entry_path(key), std::ios::binary};
+  if (!file)
+    return false;
+  data.assign(std::istreambuf_iterator<char>(file),
+              std::istreambuf_iterator<char>());
+  return !data.empty();
+}
+
+void disk_cache_t::store(uint64_t key, const void *data, size_t size) const {
+  std::filesystem::path path = entry_path(key);
+  std::filesystem::path temporary = path;
+  // unique per writer, several processes may store the same entry at once
+  temporary += "." + std::to_string(std::random_device{}()) + ".tmp";
+  {
+    std::ofstream file{temporary, std::ios::binary};
+    file.write(reinterpret_cast<const char *>(data), size);
+    if (!file) {
+      horizon_warn("failed to write cache entry {}", temporary.string());
+      return;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(temporary, path, error);
+  if (error) {
+    horizon_warn("failed to store cache entry {}: {}", path.string(),
+                 error.message());
+    std::filesystem::remove(temporary, error);
+  }
+}
+
+} // namespace photon
@@ -0,0 +1,230 @@
+#include "photon/geometry.hpp"
+
+#include "horizon/core/math.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <set>
+#include <unordered_map>
+
+namespace photon {
+
+namespace {
+
+// round to nearest even, overflows to infinity
+uint32_t float_to_half(float f) {
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  const uint32_t sign = (x >> 16) & 0x8000;
+  const int32_t exponent = int32_t((x >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = x & 0x7fffff;
+  if (((x >> 23) & 0xff) == 0xff)
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  if (exponent >= 31)
+    return sign | 0x7c00;
+  if (exponent <= 0) {
+    // denormal half
+    if (exponent < -10)
+      return sign;
+    mantissa |= 0x800000;
+    const uint32_t shift = 14 - exponent;
+    uint32_t half = mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t midpoint = 1u << (shift - 1);
+    if (rest > midpoint || (rest == midpoint && (half & 1)))
+      half++;
+    return sign | half;
+  }
+  // a carry out of the mantissa correctly bumps the exponent
+  uint32_t half = (uint32_t(exponent) << 10) | (mantissa >> 13);
+  const uint32_t rest = mantissa & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+    half++;
+  return sign | half;
+}
+
+uint32_t pack_snorm(float x, float y) {
+  auto snorm = [](float v) {
+    return uint32_t(int32_t(std::round(std::clamp(v, -1.f, 1.f) * 32767.f))) &
+           0xffff;
+  };
+  return snorm(x) | (snorm(y) << 16);
+}
+
+// octahedral mapping of a unit vector to [-1, 1]^2
+uint32_t octahedral_encode(core::vec3 n) {
+  const float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+  if (l1 <= 0)
+    return pack_snorm(0, 0);
+  n = n / l1;
+  float x = n.x, y = n.y;
+  if (n.z < 0) {
+    x = (1.f - std::abs(n.y)) * (n.x >= 0 ? 1.f : -1.f);
+    y = (1.f - std::abs(n.x)) * (n.y >= 0 ? 1.f : -1.f);
+  }
+  return pack_snorm(x, y);
+}
+
+uint32_t quantize(float v, float min, float scale) {
+  if (scale <= 0)
+    return 0;
+  return uint32_t(std::clamp(std::round((v - min) / scale), 0.f, 65535.f));
+}
+
+// same as core.slang, keeps the slab test finite for axis aligned rays
+float safe_inverse(float x) {
+  constexpr float epsilon = 0.0001f;
+  if (std::abs(x) <= epsilon)
+    return x >= 0 ? 1.f / epsilon : -1.f / epsilon;
+  return 1.f / x;
+}
+
+} // namespace
+
+ray_data_t create_ray(const core::vec3 &origin, const core::vec3 &direction,
+                      float tmin, float tmax) {
+  ray_data_t ray{};
+  ray.origin = origin;
+  ray.direction = direction;
+  ray.inv_direction =
+      core::vec3{safe_inverse(direction.x), safe_inverse(direction.y),
+                 safe_inverse(direction.z)};
+  ray.tmin = tmin;
+  ray.tmax = tmax;
+  return ray;
+}
+
+quantization_t quantization(const std::vector<core::vertex_t> &vertices) {
+  quantization_t quantization{};
+  if (vertices.empty())
+    return quantization;
+  core::vec3 min = vertices[0].position;
+  core::vec3 max = vertices[0].position;
+  for (auto &vertex : vertices) {
+    min = core::min(min, vertex.position);
+    max = core::max(max, vertex.position);
+  }
+  quantization.min = min;
+  quantization.scale = (max - min) / 65535.f;
+  return quantization;
+}
+
+compact_vertex_t compact_vertex(const core::vertex_t &vertex,
+                                const quantization_t &quantization) {
+  const core::vec3 &min = quantization.min;
+  const core::vec3 &scale = quantization.scale;
+  compact_vertex_t compact{};
+  compact.position_xy = quantize(vertex.position.x, min.x, scale.x) |
+                        quantize(vertex.position.y, min.y, scale.y) << 16;
+  compact.position_z = quantize(vertex.position.z, min.z, scale.z);
+  // the bi_tangent is rebuilt as cross(normal, tangent) times this sign
+  if (core::dot(core::cross(vertex.normal, vertex.tangent),
+                vertex.bi_tangent) < 0)
+    compact.position_z |= 1u << 31;
+  compact.normal = octahedral_encode(vertex.normal);
+  compact.tangent = octahedral_encode(vertex.tangent);
+  compact.uv = float_to_half(vertex.uv.x) | float_to_half(vertex.uv.y) << 16;
+  return compact;
+}
+
+core::vec3 decode_position(const compact_vertex_t &vertex,
+                           const quantization_t &quantization) {
+  const core::vec3 q{float(vertex.position_xy & 0xffff),
+                     float(vertex.position_xy >> 16),
+                     float(vertex.position_z & 0xffff)};
+  return quantization.min + q * quantization.scale;
+}
+
+void cluster_vertices(const std::vector<core::vertex_t> &vertices,
+                      const std::vector<uint32_t> &indices, float cell_size,
+                      std::vector<core::vertex_t> &clustered_vertices,
+                      std::vector<uint32_t> &clustered_indices) {
+  clustered_vertices.clear();
+  clustered_indices.clear();
+  if (vertices.empty() || cell_size <= 0)
+    return;
+  core::vec3 min = vertices[0].position;
+  for (auto &vertex : vertices)
+    min = core::min(min, vertex.position);
+
+  // 21 bits per axis, plenty for the grids lods use
+  auto cell_key = [&](const core::vec3 &position) {
+    const core::vec3 cell = (position - min) / cell_size;
+    auto axis = [](float v) {
+      return uint64_t(std::clamp(v, 0.f, float((1u << 21) - 1)));
+    };
+    return axis(cell.x) | axis(cell.y) << 21 | axis(cell.z) << 42;
+  };
+
+  std::unordered_map<uint64_t, uint32_t> cells{};
+  std::vector<uint32_t> remap(vertices.size());
+  std::vector<uint32_t> counts{};
+  for (uint32_t i = 0; i < vertices.size(); i++) {
+    auto [itr, inserted] = cells.try_emplace(
+        cell_key(vertices[i].position), uint32_t(clustered_vertices.size()));
+    if (inserted) {
+      clustered_vertices.push_back(vertices[i]);
+      counts.push_back(1);
+    } else {
+      core::vertex_t &cluster = clustered_vertices[itr->second];
+      cluster.position += vertices[i].position;
+      cluster.normal += vertices[i].normal;
+      counts[itr->second]++;
+    }
+    remap[i] = itr->second;
+  }
+  for (uint32_t i = 0; i < clustered_vertices.size(); i++) {
+    core::vertex_t &cluster = clustered_vertices[i];
+    cluster.position = cluster.position / float(counts[i]);
+    const float normal_length = core::length(cluster.normal);
+    if (normal_length > 0)
+      cluster.normal = cluster.normal / normal_length;
+  }
+
+  // rotated so the smallest index leads, keeps the winding
+  std::set<std::array<uint32_t, 3>> triangles{};
+  for (uint32_t i = 0; i + 2 < indices.size(); i += 3) {
+    std::array<uint32_t, 3> triangle = {remap[indices[i + 0]],
+                                        remap[indices[i + 1]],
+                                        remap[indices[i + 2]]};
+    if (triangle[0] == triangle[1] || triangle[1] == triangle[2] ||
+        triangle[0] == triangle[2])
+      continue;
+    std::rotate(triangle.begin(),
+                std::min_element(triangle.begin(), triangle.end()),
+                triangle.end());
+    if (triangles.insert(triangle).second)
+      clustered_indices.insert(clustered_indices.end(), triangle.begin(),
+                               triangle.end());
+  }
+
+  // drop the vertices no triangle references anymore
+  std::vector<uint32_t> compacted(clustered_vertices.size(), UINT32_MAX);
+  std::vector<core::vertex_t> used{};
+  for (uint32_t &index : clustered_indices) {
+    if (compacted[index] == UINT32_MAX) {
+      compacted[index] = used.size();
+      used.push_back(clustered_vertices[index]);
+    }
+    index = compacted[index];
+  }
+  clustered_vertices = std::move(used);
+}
+
+compact_triangle_t compact_triangle(const compact_vertex_t &v0,
+                                    const compact_vertex_t &v1,
+                                    const compact_vertex_t &v2) {
+  const uint32_t q[9] = {
+      v0.position_xy & 0xffff, v0.position_xy >> 16, v0.position_z & 0xffff,
+      v1.position_xy & 0xffff, v1.position_xy >> 16, v1.position_z & 0xffff,
+      v2.position_xy & 0xffff, v2.position_xy >> 16, v2.position_z & 0xffff,
+  };
+  compact_triangle_t triangle{};
+  for (uint32_t i = 0; i < 9; i++)
+    triangle.positions[i / 2] |= q[i] << (16 * (i % 2));
+  return triangle;
+}
+
+} // namespace photon
@@ -1,5 +1,7 @@
 #include "photon/renderer.hpp"
 #include "horizon/core/bvh.hpp"
+#include "photon/bvh.hpp"
+#include "photon/bvh_report.hpp"
 #include "photon/types.hpp"
 #include "photon/utils.hpp"
 #include "glm/ext/quaternion_common.hpp"
@@ -16,8 +18,13 @@
 #include "horizon/gfx/helper.hpp"
 #include "horizon/gfx/types.hpp"
 #include "imgui.h"
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cmath>
 #include <cstring>
+#include <fstream>
+#include <future>
 #include <vector>
 #include <vulkan/vulkan_core.h>
 
@@ -28,89 +35,71 @@ renderer_t::renderer_t(uint32_t width, uint32_t height,
                        core::ref<gfx::context_t> context,
                        core::ref<gfx::base_t> base,
                        core::ref<core::dispatcher_t> dispatcher,
-                       const std::filesystem::path &photon_assets_path)
+                       const std::filesystem::path &photon_assets_path,
+                       const std::filesystem::path &cache_path)
     : _width(width), _height(height), _window(window), _context(context),
       _base(base), _dispatcher(dispatcher),
-      _photon_assets_path(photon_assets_path) {
+      _photon_assets_path(photon_assets_path),
+      _shader_cache(context, cache_path / "shaders"),
+      _texture_cache(cache_path / "textures") {
   _dispatcher->subscribe<resize_event_t>([this](const core::event_t &event) {
     const resize_event_t &e = reinterpret_cast<const resize_event_t &>(event);
     _width = e.width;
     _height = e.height;
     _context->wait_idle();
-    _context->destroy_image(_image);
-    _context->destroy_image(_depth);
-    _context->destroy_image(_raytrace_image);
-    _context->destroy_image_view(_image_view);
-    _context->destroy_image_view(_depth_view);
-    _context->destroy_image_view(_raytrace_image_view);
-    gfx::config_image_t ci{};
-    ci.vk_width = _width;
-    ci.vk_height = _height;
-    ci.vk_depth = 1;
-    ci.vk_type = VK_IMAGE_TYPE_2D;
-    ci.vk_format = VK_FORMAT_R8G8B8A8_SRGB;
-    ci.vk_usage =
-        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-    ci.vma_allocation_create_flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
-    ci.vk_mips = 1;
-    ci.debug_name = "IMAGE";
-    _image = _context->create_image(ci);
-    _image_view = _context->create_image_view({.handle_image = _image});
-    ci.vk_format = VK_FORMAT_D32_SFLOAT;
-    ci.vk_usage = {};
-    ci.vk_usage = VK_IMAGE_USAGE_SAMPLED_BIT |
-                  VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-    ci.debug_name = "DEPTH";
-    _depth = _context->create_image(ci);
-    _depth_view = _context->create_image_view({.handle_image = _depth});
-    ci.vk_format = VK_FORMAT_R8G8B8A8_UNORM;
-    ci.vk_usage = {};
-    ci.vk_usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
-    ci.debug_name = "RAYTRACE_IMAGE";
-    _raytrace_image = _context->create_image(ci);
-    _raytrace_image_view =
-        _context->create_image_view({.handle_image = _raytrace_image});
-    _base->set_bindless_storage_image(0, _raytrace_image_view);
-
-    _context->destroy_buffer(_ray_data_buffer);
-    gfx::config_buffer_t cb{};
-    cb.vk_buffer_usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-    cb.vma_allocation_create_flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
-    cb.vk_size = sizeof(ray_data_t) * _width * _height;
-    _ray_data_buffer = _context->create_buffer(cb);
-    cb.vk_size = sizeof(hit_t) * _width * _height *
-                 1.75; // overallocating for debug data
-    _hits_buffer = _context->create_buffer(cb);
+    destroy_images();
+    create_images();
+    // render targets are sized for the largest output seen so far, dynamic
+    // resolution only ever renders into a sub rectangle of them
+    if (_width > _max_width || _height > _max_height) {
+      _max_width = std::max(_max_width, _width);
+      _max_height = std::max(_max_height, _height);
+      destroy_render_targets();
+      create_render_targets();
+    }
   });
-  gfx::config_image_t ci{};
-  ci.vk_width = _width;
-  ci.vk_height = _height;
-  ci.vk_depth = 1;
-  ci.vk_type = VK_IMAGE_TYPE_2D;
-  ci.vk_format = VK_FORMAT_R8G8B8A8_SRGB;
-  ci.vk_usage =
-      VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-  ci.vma_allocation_create_flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
-  ci.vk_mips = 1;
-  ci.debug_name = "IMAGE";
-  _image = _context->create_image(ci);
-  _image_view = _context->create_image_view({.handle_image = _image});
-  ci.vk_format = VK_FORMAT_D32_SFLOAT;
-  ci.vk_usage = {};
-  ci.vk_usage =
-      VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-  ci.debug_name = "DEPTH";
-  _depth = _context->create_image(ci);
-  _depth_view = _context->create_image_view({.handle_image = _depth});
-  ci.vk_format = VK_FORMAT_R8G8B8A8_UNORM;
-  ci.vk_usage = {};
-  ci.vk_usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
-  ci.debug_name = "RAYTRACE_IMAGE";
-  _raytrace_image = _context->create_image(ci);
-  _raytrace_image_view =
-      _context->create_image_view({.handle_image = _raytrace_image});
-  assert(_base->new_bindless_storage_image().val == 0);
-  _base->set_bindless_storage_image(0, _raytrace_image_view);
+  _dispatcher->subscribe<model_added_event_t>(
+      [this](const core::event_t &event) {
+        const model_added_event_t &e =
+            reinterpret_cast<const model_added_event_t &>(event);
+        _added_entities.push_back(e.id);
+      });
+  _dispatcher->subscribe<model_removed_event_t>(
+      [this](const core::event_t &event) {
+        const model_removed_event_t &e =
+            reinterpret_cast<const model_removed_event_t &>(event);
+        _removed_entities.push_back(e.id);
+      });
+  _dispatcher->subscribe<transform_changed_event_t>(
+      [this](const core::event_t &event) {
+        const transform_changed_event_t &e =
+            reinterpret_cast<const transform_changed_event_t &>(event);
+        _dirty_transforms.insert(e.id);
+      });
+  _max_width = _width;
+  _max_height = _height;
+  // the slots are handed out in order, reserved outside of assert so they
+  // are still reserved under NDEBUG
+  auto reserve_storage_image = [&]([[maybe_unused]] uint32_t expected) {
+    [[maybe_unused]] auto slot = _base->new_bindless_storage_image();
+    assert(slot.val == expected);
+  };
+  reserve_storage_image(output_storage_image);
+  reserve_storage_image(render_storage_image);
+  for (uint32_t i = 0; i < uint32_t(aov_t::e_count); i++) {
+    reserve_storage_image(aov_storage_image + i);
+    _aov_images[i] = core::null_handle;
+    _aov_views[i] = core::null_handle;
+  }
+  reserve_storage_image(visibility_storage_image);
+  reserve_storage_image(views_storage_image);
+  for (uint32_t i = 0; i < 2; i++) {
+    _denoise_history[i] = core::null_handle;
+    _denoise_moments[i] = core::null_handle;
+    _denoise_filter[i] = core::null_handle;
+  }
+  create_images();
+  create_render_targets();
 
   { // _debug_diffuse_pipeline
     gfx::config_pipeline_layout_t cpl{};
@@ -133,66 +122,177 @@ renderer_t::renderer_t(uint32_t width, uint32_t height,
             .depthBoundsTestEnable = VK_FALSE,
             .stencilTestEnable = VK_FALSE,
         });
-    cp.add_shader(gfx::helper::create_slang_shader(
-        *_context,
+    cp.add_shader(_shader_cache.create_shader(
         _photon_assets_path.string() + "/shaders/debug_view/diffuse/vert.slang",
         gfx::shader_type_t::e_vertex));
-    cp.add_shader(gfx::helper::create_slang_shader(
-        *_context,
+    cp.add_shader(_shader_cache.create_shader(
         _photon_assets_path.string() + "/shaders/debug_view/diffuse/frag.slang",
         gfx::shader_type_t::e_fragment));
     _debug_diffuse_pipeline = _context->create_graphics_pipeline(cp);
   }
 
-  { // _raygen_pipeline
+  { // _visibility_pipeline
+    gfx::config_pipeline_layout_t cpl{};
+    cpl.add_descriptor_set_layout(_base->_bindless_descriptor_set_layout);
+    cpl.add_push_constant(sizeof(push_constant_visibility_t),
+                          VK_SHADER_STAGE_ALL);
+    _visibility_pipeline_layout = context->create_pipeline_layout(cpl);
+
+    gfx::config_pipeline_t cp{};
+    cp.debug_name = "_visibility_pipeline";
+    cp.handle_pipeline_layout = _visibility_pipeline_layout;
+    cp.add_color_attachment(VK_FORMAT_R32G32_UINT,
+                            gfx::default_color_blend_attachment());
+    cp.set_depth_attachment(
+        VK_FORMAT_D32_SFLOAT,
+        VkPipelineDepthStencilStateCreateInfo{
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+            .depthTestEnable = VK_TRUE,
+            .depthWriteEnable = VK_TRUE,
+            .depthCompareOp = VK_COMPARE_OP_LESS,
+            .depthBoundsTestEnable = VK_FALSE,
+            .stencilTestEnable = VK_FALSE,
+        });
+    cp.add_shader(_shader_cache.create_shader(
+        _photon_assets_path.string() + "/shaders/visibility/vert.slang",
+        gfx::shader_type_t::e_vertex));
+    cp.add_shader(_shader_cache.create_shader(
+        _photon_assets_path.string() + "/shaders/visibility/frag.slang",
+        gfx::shader_type_t::e_fragment));
+    _visibility_pipeline = _context->create_graphics_pipeline(cp);
+  }
+
+  { // _raygen_pipeline_layout, pipelines are permutations, see
+    // permutation_pipeline
     gfx::config_pipeline_layout_t cpl{};
     cpl.add_descriptor_set_layout(_base->_bindless_descriptor_set_layout);
     cpl.add_push_constant(sizeof(push_constant_raytracing_t),
                           VK_SHADER_STAGE_ALL);
     _raygen_pipeline_layout = context->create_pipeline_layout(cpl);
+  }
+
+  { // _cull_pipeline
+    gfx::config_pipeline_layout_t cpl{};
+    cpl.add_descriptor_set_layout(_base->_bindless_descriptor_set_layout);
+    cpl.add_push_constant(sizeof(push_constant_cull_t), VK_SHADER_STAGE_ALL);
+    _cull_pipeline_layout = context->create_pipeline_layout(cpl);
 
     gfx::config_pipeline_t cp{};
-    cp.debug_name = "_raygen_pipeline";
-    cp.handle_pipeline_layout = _raygen_pipeline_layout;
-    cp.add_shader(gfx::helper::create_slang_shader(
-        *_context,
-        _photon_assets_path.string() + "/shaders/raytracing/raygen.slang",
+    cp.debug_name = "_cull_pipeline";
+    cp.handle_pipeline_layout = _cull_pipeline_layout;
+    cp.add_shader(_shader_cache.create_shader(
+        _photon_assets_path.string() + "/shaders/raytracing/cull.slang",
         gfx::shader_type_t::e_compute));
-    _raygen_pipeline = _context->create_compute_pipeline(cp);
+    _cull_pipeline = _context->create_compute_pipeline(cp);
   }
 
-  { // _trace_pipeline
+  { // _trace_pipeline_layout, pipelines are permutations, see
+    // permutation_pipeline
     gfx::config_pipeline_layout_t cpl{};
     cpl.add_descriptor_set_layout(_base->_bindless_descriptor_set_layout);
     cpl.add_push_constant(sizeof(push_constant_raytracing_t),
                           VK_SHADER_STAGE_ALL);
     _trace_pipeline_layout = context->create_pipeline_layout(cpl);
-
-    gfx::config_pipeline_t cp{};
-    cp.debug_name = "_trace_pipeline";
-    cp.handle_pipeline_layout = _trace_pipeline_layout;
-    cp.add_shader(gfx::helper::create_slang_shader(
-        *_context,
-        _photon_assets_path.string() + "/shaders/raytracing/trace.slang",
-        gfx::shader_type_t::e_compute));
-    _trace_pipeline = _context->create_compute_pipeline(cp);
   }
 
-  { // _shade_pipeline
+  { // _shade_pipeline_layout
     gfx::config_pipeline_layout_t cpl{};
     cpl.add_descriptor_set_layout(_base->_bindless_descriptor_set_layout);
     cpl.add_push_constant(sizeof(push_constant_raytracing_t),
                           VK_SHADER_STAGE_ALL);
     _shade_pipeline_layout = context->create_pipeline_layout(cpl);
+  }
+
+  { // _upscale_pipeline
+    gfx::config_pipeline_layout_t cpl{};
+    cpl.add_descriptor_set_layout(_base->_bindless_descriptor_set_layout);
+    cpl.add_push_constant(sizeof(push_constant_upscale_t),
+                          VK_SHADER_STAGE_ALL);
+    _upscale_pipeline_layout = context->create_pipeline_layout(cpl);
 
     gfx::config_pipeline_t cp{};
-    cp.debug_name = "_shade_pipeline";
-    cp.handle_pipeline_layout = _shade_pipeline_layout;
-    cp.add_shader(gfx::helper::create_slang_shader(
-        *_context,
-        _photon_assets_path.string() + "/shaders/raytracing/shade.slang",
+    cp.debug_name = "_upscale_pipeline";
+    cp.handle_pipeline_layout = _upscale_pipeline_layout;
+    cp.add_shader(_shader_cache.create_shader(
+        _photon_assets_path.string() + "/shaders/raytracing/upscale.slang",
         gfx::shader_type_t::e_compute));
-    _shade_pipeline = _context->create_compute_pipeline(cp);
+    _upscale_pipeline = _context->create_compute_pipeline(cp);
+  }
+
+  { // _refit_*_pipeline
+    gfx::config_pipeline_layout_t cpl{};
+    cpl.add_descriptor_set_layout(_base->_bindless_descriptor_set_layout);
+    cpl.add_push_constant(sizeof(push_constant_refit_t), VK_SHADER_STAGE_ALL);
+    _refit_pipeline_layout = context->create_pipeline_layout(cpl);
+
+    gfx::config_pipeline_t cp{};
+    cp.debug_name = "_refit_triangles_pipeline";
+    cp.handle_pipeline_layout = _refit_pipeline_layout;
+    cp.add_shader(_shader_cache.create_shader(
+        _photon_assets_path.string() + "/shaders/refit/triangles.slang",
+        gfx::shader_type_t::e_compute));
+    _refit_triangles_pipeline = _context->create_compute_pipeline(cp);
+
+    cp = {};
+    cp.debug_name = "_refit_nodes_pipeline";
+    cp.handle_pipeline_layout = _refit_pipeline_layout;
+    cp.add_shader(_shader_cache.create_shader(
+        _photon_assets_path.string() + "/shaders/refit/nodes.slang",
+        gfx::shader_type_t::e_compute));
+    _refit_nodes_pipeline = _context->create_compute_pipeline(cp);
+
+    cp = {};
+    cp.debug_name = "_refit_sah_pipeline";
+    cp.handle_pipeline_layout = _refit_pipeline_layout;
+    cp.add_shader(_shader_cache.create_shader(
+        _photon_assets_path.string() + "/shaders/refit/sah.slang",
+        gfx::shader_type_t::e_compute));
+    _refit_sah_pipeline = _context->create_compute_pipeline(cp);
+  }
+
+  { // _lbvh_*_pipeline
+    gfx::config_pipeline_layout_t cpl{};
+    cpl.add_descriptor_set_layout(_base->_bindless_descriptor_set_layout);
+    cpl.add_push_constant(sizeof(push_constant_lbvh_t), VK_SHADER_STAGE_ALL);
+    _lbvh_pipeline_layout = context->create_pipeline_layout(cpl);
+
+    auto create_pipeline = [&](const std::string &name) {
+      gfx::config_pipeline_t cp{};
+      cp.debug_name = "_lbvh_" + name + "_pipeline";
+      cp.handle_pipeline_layout = _lbvh_pipeline_layout;
+      cp.add_shader(_shader_cache.create_shader(
+          _photon_assets_path.string() + "/shaders/lbvh/" + name + ".slang",
+          gfx::shader_type_t::e_compute));
+      return _context->create_compute_pipeline(cp);
+    };
+    _lbvh_bounds_pipeline = create_pipeline("bounds");
+    _lbvh_morton_pipeline = create_pipeline("morton");
+    _lbvh_histogram_pipeline = create_pipeline("histogram");
+    _lbvh_scan_pipeline = create_pipeline("scan");
+    _lbvh_scatter_pipeline = create_pipeline("scatter");
+    _lbvh_hierarchy_pipeline = create_pipeline("hierarchy");
+    _lbvh_aabbs_pipeline = create_pipeline("aabbs");
+  }
+
+  { // _denoise_*_pipeline
+    gfx::config_pipeline_layout_t cpl{};
+    cpl.add_descriptor_set_layout(_base->_bindless_descriptor_set_layout);
+    cpl.add_push_constant(sizeof(push_constant_denoise_t),
+                          VK_SHADER_STAGE_ALL);
+    _denoise_pipeline_layout = context->create_pipeline_layout(cpl);
+
+    auto create_pipeline = [&](const std::string &name) {
+      gfx::config_pipeline_t cp{};
+      cp.debug_name = "_denoise_" + name + "_pipeline";
+      cp.handle_pipeline_layout = _denoise_pipeline_layout;
+      cp.add_shader(_shader_cache.create_shader(
+          _photon_assets_path.string() + "/shaders/denoise/" + name + ".slang",
+          gfx::shader_type_t::e_compute));
+      return _context->create_compute_pipeline(cp);
+    };
+    _denoise_temporal_pipeline = create_pipeline("temporal");
+    _denoise_atrous_pipeline = create_pipeline("atrous");
+    _denoise_modulate_pipeline = create_pipeline("modulate");
   }
 
   gfx::config_buffer_t cb{};
@@ -204,108 +304,1518 @@ renderer_t::renderer_t(uint32_t width, uint32_t height,
   cb.vma_allocation_create_flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
   cb.vk_size = sizeof(current_raytracing_param_t);
   _param_buffer = _context->create_buffer(cb);
-  cb.vk_size = sizeof(ray_data_t) * _width * _height;
-  _ray_data_buffer = _context->create_buffer(cb);
-  cb.vk_size =
-      sizeof(hit_t) * _width * _height * 1.75f; // overallocating for debug data
-  _hits_buffer = _context->create_buffer(cb);
+  _views_param_buffer = _context->create_buffer(cb);
+  cb.vk_buffer_usage_flags = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  cb.vma_allocation_create_flags =
+      VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+  cb.vk_size = sizeof(uint32_t);
+  _query_done_buffer = _context->create_buffer(cb);
+  *reinterpret_cast<uint32_t *>(_context->map_buffer(_query_done_buffer)) = 1;
+
+  // frames before the first model finished loading still bind the instance
+  // buffers
+  reserve_instances(1);
 
   _gpu_timer = core::make_ref<gpu_timer_t>(*_base, true);
 }
 
 renderer_t::~renderer_t() {
+  wait_ray_queries();
   _context->wait_idle();
+  destroy_images();
+  destroy_render_targets();
+  destroy_views();
+  for (auto &[key, pipeline] : _permutation_pipelines)
+    _context->destroy_pipeline(pipeline);
+  _context->destroy_pipeline(_cull_pipeline);
+  _context->destroy_pipeline_layout(_cull_pipeline_layout);
+  _context->destroy_pipeline_layout(_trace_pipeline_layout);
+  _context->destroy_pipeline_layout(_shade_pipeline_layout);
+  _context->destroy_pipeline(_upscale_pipeline);
+  _context->destroy_pipeline_layout(_upscale_pipeline_layout);
+  _context->destroy_pipeline(_visibility_pipeline);
+  _context->destroy_pipeline_layout(_visibility_pipeline_layout);
+  _context->destroy_pipeline(_debug_diffuse_pipeline);
+  _context->destroy_pipeline_layout(_debug_diffuse_pipeline_layout);
+  _context->destroy_pipeline(_refit_triangles_pipeline);
+  _context->destroy_pipeline(_refit_nodes_pipeline);
+  _context->destroy_pipeline(_refit_sah_pipeline);
+  _context->destroy_pipeline_layout(_refit_pipeline_layout);
+  _context->destroy_pipeline(_lbvh_bounds_pipeline);
+  _context->destroy_pipeline(_lbvh_morton_pipeline);
+  _context->destroy_pipeline(_lbvh_histogram_pipeline);
+  _context->destroy_pipeline(_lbvh_scan_pipeline);
+  _context->destroy_pipeline(_lbvh_scatter_pipeline);
+  _context->destroy_pipeline(_lbvh_hierarchy_pipeline);
+  _context->destroy_pipeline(_lbvh_aabbs_pipeline);
+  _context->destroy_pipeline_layout(_lbvh_pipeline_layout);
+  _context->destroy_pipeline(_denoise_temporal_pipeline);
+  _context->destroy_pipeline(_denoise_atrous_pipeline);
+  _context->destroy_pipeline(_denoise_modulate_pipeline);
+  _context->destroy_pipeline_layout(_denoise_pipeline_layout);
+  if (_lbvh_scratch_buffer != core::null_handle)
+    _context->destroy_buffer(_lbvh_scratch_buffer);
+  _context->destroy_buffer(_camera_buffer);
+  _context->destroy_buffer(_views_param_buffer);
+  _context->destroy_buffer(_query_done_buffer);
+  if (_instances_buffer != core::null_handle)
+    _context->destroy_buffer(_instances_buffer);
+  if (_residency_clear_buffer != core::null_handle)
+    _context->destroy_buffer(_residency_clear_buffer);
+  if (_visible_instances_buffer != core::null_handle)
+    _context->destroy_buffer(_visible_instances_buffer);
+  for (auto &[cbuf, uploads] : _frame_uploads) {
+    for (gfx::handle_buffer_t buffer :
+         {uploads.instances, uploads.transforms, uploads.vertices,
+          uploads.sah, uploads.residency})
+      if (buffer != core::null_handle)
+        _context->destroy_buffer(buffer);
+    for (gfx::handle_buffer_t buffer : uploads.retired)
+      _context->destroy_buffer(buffer);
+    uploads.retired_models.clear();
+  }
+}
+
+void renderer_t::create_images() {
+  gfx::config_image_t ci{};
+  ci.vk_width = _width;
+  ci.vk_height = _height;
+  ci.vk_depth = 1;
+  ci.vk_type = VK_IMAGE_TYPE_2D;
+  ci.vk_format = VK_FORMAT_R8G8B8A8_SRGB;
+  ci.vk_usage =
+      VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+  ci.vma_allocation_create_flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+  ci.vk_mips = 1;
+  ci.debug_name = "IMAGE";
+  _image = _context->create_image(ci);
+  _image_view = _context->create_image_view({.handle_image = _image});
+  ci.vk_format = VK_FORMAT_D32_SFLOAT;
+  ci.vk_usage = {};
+  ci.vk_usage =
+      VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+  ci.debug_name = "DEPTH";
+  _depth = _context->create_image(ci);
+  _depth_view = _context->create_image_view({.handle_image = _depth});
+  ci.vk_format = VK_FORMAT_R8G8B8A8_UNORM;
+  ci.vk_usage = {};
+  ci.vk_usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+  ci.debug_name = "RAYTRACE_IMAGE";
+  _raytrace_image = _context->create_image(ci);
+  _raytrace_image_view =
+      _context->create_image_view({.handle_image = _raytrace_image});
+  _base->set_bindless_storage_image(output_storage_image, _raytrace_image_view);
+}
+
+void renderer_t::destroy_images() {
   _context->destroy_image(_image);
   _context->destroy_image(_depth);
+  _context->destroy_image(_raytrace_image);
   _context->destroy_image_view(_image_view);
   _context->destroy_image_view(_depth_view);
-  _context->destroy_pipeline(_debug_diffuse_pipeline);
-  _context->destroy_pipeline_layout(_debug_diffuse_pipeline_layout);
-  _context->destroy_buffer(_camera_buffer);
+  _context->destroy_image_view(_raytrace_image_view);
 }
 
-gfx::handle_image_view_t renderer_t::render(core::ref<ecs::scene_t<>> scene,
-                                            const core::camera_t &camera) {
-  // prepare
-  scene->for_all<core::raw_model_t>([&](ecs::entity_id_t id,
-                                        const core::raw_model_t &raw_model) {
-    if (scene->has<model_t>(id))
-      return;
-    _update_instances_buffer = true;
-    // upload model data to GPU
-    scene->construct<model_t>(id) =
-        std::move(raw_model_to_model(_base, _photon_assets_path, raw_model));
-  });
+void renderer_t::create_render_targets() {
+  gfx::config_image_t ci{};
+  ci.vk_width = _max_width;
+  ci.vk_height = _max_height;
+  ci.vk_depth = 1;
+  ci.vk_type = VK_IMAGE_TYPE_2D;
+  ci.vk_format = VK_FORMAT_R8G8B8A8_UNORM;
+  ci.vk_usage = VK_IMAGE_USAGE_STORAGE_BIT;
+  ci.vma_allocation_create_flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+  ci.vk_mips = 1;
+  ci.debug_name = "RENDER_IMAGE";
+  _render_image = _context->create_image(ci);
+  _render_image_view =
+      _context->create_image_view({.handle_image = _render_image});
+  _base->set_bindless_storage_image(render_storage_image, _render_image_view);
 
-  if (_update_instances_buffer) {
-    _update_instances_buffer = false;
-    std::vector<bvh_instance_t> instances{};
-    scene->for_all<model_t>([&](auto, const model_t &model) {
-      for (const auto &mesh : model.meshes) {
-
-        // struct bvh_instance_t {
-        //   core::vertex_t *vertices;
-        //   uint32_t *indices;
-        //
-        //   // bvh
-        //   core::bvh::node_t *nodes;
-        //   /* bvh indices buffer
-        //    * To get the bvh triangle, directly use index
-        //    * To get the vertices, the indices are as follows
-        //    * indices in normal index buffer are as follows
-        //    *    primitive_index * 3 + 0
-        //    *    primitive_index * 3 + 1
-        //    *    primitive_index * 3 + 2
-        //    * */
-        //   uint32_t *primitive_indices;
-        //   triangle_t *bvh_triangles;
-        //
-        //   core::mat4 *model;
-        //   core::mat4 inv_model;
-        //
-        //   gfx::handle_bindless_image_t diffuse_bindless;
-        // };
-        bvh_instance_t instance{};
-        instance.vertices = gfx::to<core::vertex_t *>(
-            _context->get_buffer_device_address(mesh.vertex_buffer));
-        instance.indices = gfx::to<uint32_t *>(
-            _context->get_buffer_device_address(mesh.index_buffer));
-        instance.nodes = gfx::to<core::bvh::node_t *>(
-            _context->get_buffer_device_address(mesh.nodes_buffer));
-        instance.primitive_indices = gfx::to<uint32_t *>(
-            _context->get_buffer_device_address(mesh.primitive_index_buffer));
-        instance.bvh_triangles = gfx::to<triangle_t *>(
-            _context->get_buffer_device_address(mesh.bvh_triangles_buffer));
-        instance.model = gfx::to<core::mat4 *>(
-            _context->get_buffer_device_address(mesh.model_buffer));
-        instance.inv_model = gfx::to<core::mat4 *>(
-            _context->get_buffer_device_address(mesh.inv_model_buffer));
+  ci.vk_format = VK_FORMAT_R32G32_UINT;
+  ci.vk_usage =
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_STORAGE_BIT;
+  ci.debug_name = "VISIBILITY_IMAGE";
+  _visibility_image = _context->create_image(ci);
+  _visibility_image_view =
+      _context->create_image_view({.handle_image = _visibility_image});
+  _base->set_bindless_storage_image(visibility_storage_image,
+                                    _visibility_image_view);
+  ci.vk_format = VK_FORMAT_D32_SFLOAT;
+  ci.vk_usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+  ci.debug_name = "VISIBILITY_DEPTH";
+  _visibility_depth = _context->create_image(ci);
+  _visibility_depth_view =
+      _context->create_image_view({.handle_image = _visibility_depth});
 
-        instances.push_back(instance);
-      }
-    });
-    if (_instances_buffer != core::null_handle) {
-      _context->destroy_buffer(_instances_buffer);
+  gfx::config_buffer_t cb{};
+  cb.vk_buffer_usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  cb.vma_allocation_create_flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+  cb.vk_size = ray_size() * _max_width * _max_height;
+  _ray_data_buffer = _context->create_buffer(cb);
+  cb.vk_size = sizeof(hit_t) * _max_width * _max_height *
+               1.75f; // overallocating for debug data
+  _hits_buffer = _context->create_buffer(cb);
+  _primary_hits_valid = false;
+
+  create_aov_images();
+  if (_denoise)
+    create_denoise_buffers();
+}
+
+void renderer_t::destroy_render_targets() {
+  destroy_aov_images();
+  destroy_denoise_buffers();
+  _context->destroy_image_view(_visibility_image_view);
+  _context->destroy_image(_visibility_image);
+  _context->destroy_image_view(_visibility_depth_view);
+  _context->destroy_image(_visibility_depth);
+  _context->destroy_image(_render_image);
+  _context->destroy_image_view(_render_image_view);
+  _context->destroy_buffer(_ray_data_buffer);
+  _context->destroy_buffer(_hits_buffer);
+}
+
+void renderer_t::reserve_views(uint32_t width, uint32_t height,
+                               uint32_t count) {
+  const bool grow_image =
+      width > _views_width || height * count > _views_height;
+  const bool grow_rays = width * height * count > _views_ray_capacity;
+  const bool grow_cameras = count > _views_camera_capacity;
+  if (!grow_image && !grow_rays && !grow_cameras)
+    return;
+  // earlier batches may still be reading the old targets
+  _context->wait_idle();
+
+  if (grow_image) {
+    if (_views_image != core::null_handle) {
+      _context->destroy_image_view(_views_image_view);
+      _context->destroy_image(_views_image);
+    }
+    _views_width = std::max(width, _views_width);
+    _views_height = std::max(height * count, _views_height);
+    gfx::config_image_t ci{};
+    ci.vk_width = _views_width;
+    ci.vk_height = _views_height;
+    ci.vk_depth = 1;
+    ci.vk_type = VK_IMAGE_TYPE_2D;
+    ci.vk_format = VK_FORMAT_R8G8B8A8_UNORM;
+    ci.vk_usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    ci.vma_allocation_create_flags =
+        VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+    ci.vk_mips = 1;
+    ci.debug_name = "VIEWS_IMAGE";
+    _views_image = _context->create_image(ci);
+    _views_image_view =
+        _context->create_image_view({.handle_image = _views_image});
+    _base->set_bindless_storage_image(views_storage_image, _views_image_view);
+  }
+
+  gfx::config_buffer_t cb{};
+  cb.vk_buffer_usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  if (grow_rays) {
+    if (_views_ray_data_buffer != core::null_handle) {
+      _context->destroy_buffer(_views_ray_data_buffer);
+      _context->destroy_buffer(_views_hits_buffer);
     }
+    _views_ray_capacity =
+        std::max(width * height * count, _views_ray_capacity * 2);
+    cb.vma_allocation_create_flags =
+        VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+    cb.vk_size = ray_size() * _views_ray_capacity;
+    _views_ray_data_buffer = _context->create_buffer(cb);
+    cb.vk_size = sizeof(hit_t) * _views_ray_capacity *
+                 1.75f; // overallocating for debug data
+    _views_hits_buffer = _context->create_buffer(cb);
+  }
+  if (grow_cameras) {
+    if (_views_camera_buffer != core::null_handle)
+      _context->destroy_buffer(_views_camera_buffer);
+    _views_camera_capacity = std::max(count, _views_camera_capacity * 2);
+    cb.vma_allocation_create_flags =
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+    cb.vk_size = sizeof(camera_t) * _views_camera_capacity;
+    _views_camera_buffer = _context->create_buffer(cb);
+  }
+}
 
-    _num_blas_instances = instances.size();
+void renderer_t::destroy_views() {
+  if (_views_image != core::null_handle) {
+    _context->destroy_image_view(_views_image_view);
+    _context->destroy_image(_views_image);
+  }
+  if (_views_ray_data_buffer != core::null_handle) {
+    _context->destroy_buffer(_views_ray_data_buffer);
+    _context->destroy_buffer(_views_hits_buffer);
+  }
+  if (_views_camera_buffer != core::null_handle)
+    _context->destroy_buffer(_views_camera_buffer);
+}
 
+size_t renderer_t::ray_size() const {
+  return _compact_rays ? sizeof(compact_ray_t) : sizeof(ray_data_t);
+}
+
+void renderer_t::create_aov_images() {
+  const VkFormat formats[] = {
+      VK_FORMAT_R32_SFLOAT,          // e_depth
+      VK_FORMAT_R16G16B16A16_SFLOAT, // e_normal
+      VK_FORMAT_R8G8B8A8_UNORM,      // e_albedo
+      VK_FORMAT_R16G16_SFLOAT,       // e_motion
+      VK_FORMAT_R32G32_UINT,         // e_ids
+  };
+  const char *names[] = {"AOV_DEPTH", "AOV_NORMAL", "AOV_ALBEDO",
+                         "AOV_MOTION", "AOV_IDS"};
+  gfx::config_image_t ci{};
+  ci.vk_width = _max_width;
+  ci.vk_height = _max_height;
+  ci.vk_depth = 1;
+  ci.vk_type = VK_IMAGE_TYPE_2D;
+  ci.vk_usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  ci.vma_allocation_create_flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+  ci.vk_mips = 1;
+  for (uint32_t i = 0; i < uint32_t(aov_t::e_count); i++) {
+    if (!(_active_aovs & aov_bit(aov_t(i))))
+      continue;
+    ci.vk_format = formats[i];
+    ci.debug_name = names[i];
+    _aov_images[i] = _context->create_image(ci);
+    _aov_views[i] =
+        _context->create_image_view({.handle_image = _aov_images[i]});
+    _base->set_bindless_storage_image(aov_storage_image + i, _aov_views[i]);
+  }
+}
+
+void renderer_t::destroy_aov_images() {
+  for (uint32_t i = 0; i < uint32_t(aov_t::e_count); i++) {
+    if (_aov_images[i] == core::null_handle)
+      continue;
+    _context->destroy_image_view(_aov_views[i]);
+    _context->destroy_image(_aov_images[i]);
+    _aov_images[i] = core::null_handle;
+    _aov_views[i] = core::null_handle;
+  }
+}
+
+void renderer_t::update_aov_images() {
+  uint32_t active = _aovs;
+  if (_denoise)
+    active |= aov_bit(aov_t::e_depth) | aov_bit(aov_t::e_normal) |
+              aov_bit(aov_t::e_albedo) | aov_bit(aov_t::e_motion);
+  if (active == _active_aovs)
+    return;
+  // frames in flight may still be writing the old targets
+  _context->wait_idle();
+  destroy_aov_images();
+  _active_aovs = active;
+  create_aov_images();
+}
+
+void renderer_t::apply_settings() {
+  if (_requested_compact_rays != _compact_rays) {
+    // frames in flight may still be tracing from the old ray buffers
+    _context->wait_idle();
+    _compact_rays = _requested_compact_rays;
     gfx::config_buffer_t cb{};
-    cb.vk_size = instances.size() * sizeof(instances[0]);
     cb.vk_buffer_usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
-    cb.vma_allocation_create_flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
-    _instances_buffer = gfx::helper::create_buffer_staged(
-        *_context, _base->_command_pool, cb, instances.data(), cb.vk_size);
+    cb.vma_allocation_create_flags =
+        VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+    cb.vk_size = ray_size() * _max_width * _max_height;
+    _context->destroy_buffer(_ray_data_buffer);
+    _ray_data_buffer = _context->create_buffer(cb);
+    _primary_hits_valid = false;
+    // reserve_views reallocates them on the next batch
+    if (_views_ray_data_buffer != core::null_handle) {
+      _context->destroy_buffer(_views_ray_data_buffer);
+      _context->destroy_buffer(_views_hits_buffer);
+      _views_ray_data_buffer = core::null_handle;
+      _views_hits_buffer = core::null_handle;
+      _views_ray_capacity = 0;
+    }
+  }
+  if (_requested_denoise != _denoise) {
+    // frames in flight may still be filtering with the old buffers
+    _context->wait_idle();
+    _denoise = _requested_denoise;
+    if (_denoise)
+      create_denoise_buffers();
+    else
+      destroy_denoise_buffers();
+    update_aov_images();
+  }
+  if (_requested_aovs != _aovs) {
+    _aovs = _requested_aovs;
+    update_aov_images();
   }
+}
 
-  // draw
+void renderer_t::create_denoise_buffers() {
+  gfx::config_buffer_t cb{};
+  cb.vk_buffer_usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  cb.vma_allocation_create_flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+  const size_t pixels = size_t(_max_width) * _max_height;
+  for (uint32_t i = 0; i < 2; i++) {
+    cb.vk_size = pixels * 2 * sizeof(uint32_t);
+    _denoise_history[i] = _context->create_buffer(cb);
+    _denoise_filter[i] = _context->create_buffer(cb);
+    cb.vk_size = pixels * 2 * sizeof(float);
+    _denoise_moments[i] = _context->create_buffer(cb);
+  }
+  cb.vk_size = pixels * 4 * sizeof(float);
+  _denoise_guides = _context->create_buffer(cb);
+  _denoise_width = _denoise_height = 0;
+}
+
+void renderer_t::destroy_denoise_buffers() {
+  if (_denoise_guides == core::null_handle)
+    return;
+  for (uint32_t i = 0; i < 2; i++) {
+    _context->destroy_buffer(_denoise_history[i]);
+    _context->destroy_buffer(_denoise_filter[i]);
+    _context->destroy_buffer(_denoise_moments[i]);
+    _denoise_history[i] = core::null_handle;
+    _denoise_filter[i] = core::null_handle;
+    _denoise_moments[i] = core::null_handle;
+  }
+  _context->destroy_buffer(_denoise_guides);
+  _denoise_guides = core::null_handle;
+}
+
+void renderer_t::denoise(gfx::handle_commandbuffer_t cbuf, uint32_t width,
+                         uint32_t height) {
+  auto address = [&](gfx::handle_buffer_t buffer) {
+    return _context->get_buffer_device_address(buffer);
+  };
+  auto barrier = [&](gfx::handle_buffer_t buffer) {
+    _context->cmd_buffer_memory_barrier(
+        cbuf, buffer, _context->get_buffer(buffer).config.vk_size, 0,
+        VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+  };
+  auto dispatch = [&](gfx::handle_pipeline_t pipeline,
+                      const push_constant_denoise_t &pc) {
+    _context->cmd_bind_pipeline(cbuf, pipeline);
+    _context->cmd_bind_descriptor_sets(cbuf, pipeline, 0,
+                                       {_base->_bindless_descriptor_set});
+    _context->cmd_push_constants(cbuf, pipeline, VK_SHADER_STAGE_ALL, 0,
+                                 sizeof(push_constant_denoise_t), &pc);
+    _context->cmd_dispatch(cbuf, (width + 8 - 1) / 8, (height + 8 - 1) / 8,
+                           1);
+  };
+
+  const uint32_t in = _denoise_history_index;
+  const uint32_t out = 1 - in;
+
+  push_constant_denoise_t pc{};
+  pc.history_in = gfx::to<uint32_t *>(address(_denoise_history[in]));
+  pc.history_out = gfx::to<uint32_t *>(address(_denoise_history[out]));
+  pc.moments_in = gfx::to<float *>(address(_denoise_moments[in]));
+  pc.moments_out = gfx::to<float *>(address(_denoise_moments[out]));
+  pc.filter_out = gfx::to<uint32_t *>(address(_denoise_filter[0]));
+  pc.guides = gfx::to<float *>(address(_denoise_guides));
+  pc.width = width;
+  pc.height = height;
+  pc.step = 1;
+  pc.max_history = _denoise_max_history;
+  // the history is indexed by pixel, a new render resolution invalidates it
+  pc.reset = width != _denoise_width || height != _denoise_height;
+  pc.depth_sigma = _denoise_depth_sigma;
+  pc.normal_power = _denoise_normal_power;
+  pc.luminance_sigma = _denoise_luminance_sigma;
+
+  _gpu_timer->start(cbuf, "denoise");
+  // written by the last frame
+  barrier(_denoise_history[in]);
+  barrier(_denoise_moments[in]);
+  barrier(_denoise_guides);
+  dispatch(_denoise_temporal_pipeline, pc);
+  barrier(_denoise_filter[0]);
+
+  uint32_t filtered = 0;
+  for (int i = 0; i < _denoise_iterations; i++) {
+    pc.step = 1u << i;
+    pc.filter_in = gfx::to<uint32_t *>(address(_denoise_filter[filtered]));
+    pc.filter_out = gfx::to<uint32_t *>(address(_denoise_filter[1 - filtered]));
+    dispatch(_denoise_atrous_pipeline, pc);
+    filtered = 1 - filtered;
+    barrier(_denoise_filter[filtered]);
+  }
+
+  pc.filter_in = gfx::to<uint32_t *>(address(_denoise_filter[filtered]));
+  dispatch(_denoise_modulate_pipeline, pc);
+  _gpu_timer->end(cbuf, "denoise");
+  _context->cmd_image_memory_barrier(
+      cbuf, _render_image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+      VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+  _denoise_history_index = out;
+  _denoise_width = width;
+  _denoise_height = height;
+}
+
+void renderer_t::update_render_scale() {
+  if (!_dynamic_resolution) {
+    _render_scale = 1.f;
+    return;
+  }
+  auto times = _gpu_timer->get_times();
+  float frame_time = 0;
+  for (const char *pass :
+       {"visibility", "cull", "raygen", "trace", "shade", "denoise"})
+    if (times.contains(pass))
+      frame_time += times[pass];
+  if (frame_time <= 0)
+    return;
+  // cost scales with the pixel count, so with the square of the scale, only
+  // move part of the way each frame to not oscillate on noisy timings
+  float ideal_scale =
+      _render_scale * std::sqrt(_target_frame_time / frame_time);
+  _render_scale += (ideal_scale - _render_scale) * 0.1f;
+  _render_scale = std::clamp(_render_scale, _min_render_scale, 1.f);
+}
+
+void renderer_t::reserve_instances(uint32_t count) {
+  if (count <= _instances_capacity)
+    return;
+  uint32_t capacity = std::max(count, _instances_capacity * 2);
+  if (_instances_buffer != core::null_handle) {
+    // frames in flight may still be reading the old buffer
+    _context->wait_idle();
+    _context->destroy_buffer(_instances_buffer);
+  }
+  gfx::config_buffer_t cb{};
+  cb.vk_size = capacity * sizeof(bvh_instance_t);
+  cb.vk_buffer_usage_flags =
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  cb.vma_allocation_create_flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+  _instances_buffer = _context->create_buffer(cb);
+  _instances_capacity = capacity;
+  _instances_dirty = true;
+
+  if (_residency_clear_buffer != core::null_handle)
+    _context->destroy_buffer(_residency_clear_buffer);
+  cb.vk_buffer_usage_flags = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  cb.vk_size = 2 * capacity * sizeof(uint32_t);
+  cb.vma_allocation_create_flags = {};
+  std::vector<uint32_t> zeroes(2 * capacity, 0);
+  _residency_clear_buffer = gfx::helper::create_buffer_staged(
+      *_context, _base->_command_pool, cb, zeroes.data(), cb.vk_size);
+
+  cb.vk_buffer_usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  if (_visible_instances_buffer != core::null_handle)
+    _context->destroy_buffer(_visible_instances_buffer);
+  cb.vk_size = (1 + capacity) * sizeof(uint32_t);
+  cb.vma_allocation_create_flags = {};
+  _visible_instances_buffer = _context->create_buffer(cb);
+}
+
+gfx::handle_pipeline_t
+renderer_t::permutation_pipeline(const std::string &shader,
+                                 gfx::handle_pipeline_layout_t layout,
+                                 const shader_defines_t &defines) {
+  std::string key = shader;
+  for (auto &[name, value] : defines)
+    key += " " + name + "=" + value;
+  auto itr = _permutation_pipelines.find(key);
+  if (itr != _permutation_pipelines.end())
+    return itr->second;
+
+  gfx::config_pipeline_t cp{};
+  cp.debug_name = "_" + shader + "_pipeline";
+  cp.handle_pipeline_layout = layout;
+  cp.add_shader(_shader_cache.create_shader(
+      _photon_assets_path.string() + "/shaders/raytracing/" + shader +
+          ".slang",
+      gfx::shader_type_t::e_compute, defines));
+  gfx::handle_pipeline_t pipeline = _context->create_compute_pipeline(cp);
+  _permutation_pipelines[key] = pipeline;
+  return pipeline;
+}
+
+void renderer_t::rasterize_visibility(gfx::handle_commandbuffer_t cbuf,
+                                      uint32_t width, uint32_t height) {
+  _context->cmd_image_memory_barrier(
+      cbuf, _visibility_image, VK_IMAGE_LAYOUT_UNDEFINED,
+      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, 0,
+      VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+  _context->cmd_image_memory_barrier(
+      cbuf, _visibility_depth, VK_IMAGE_LAYOUT_UNDEFINED,
+      VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, 0,
+      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+      VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+          VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+      VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+          VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT);
+
+  gfx::rendering_attachment_t color_rendering_attachment{};
+  for (uint32_t i = 0; i < 4; i++)
+    color_rendering_attachment.clear_value.color.uint32[i] = 0xffffffffu;
+  color_rendering_attachment.image_layout =
+      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  color_rendering_attachment.load_op = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  color_rendering_attachment.store_op = VK_ATTACHMENT_STORE_OP_STORE;
+  color_rendering_attachment.handle_image_view = _visibility_image_view;
+
+  gfx::rendering_attachment_t depth_rendering_attachment{};
+  depth_rendering_attachment.clear_value.depthStencil.depth = 1;
+  depth_rendering_attachment.image_layout =
+      VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+  depth_rendering_attachment.load_op = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  depth_rendering_attachment.store_op = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depth_rendering_attachment.handle_image_view = _visibility_depth_view;
+
+  _gpu_timer->start(cbuf, "visibility");
+  _context->cmd_begin_rendering(cbuf, {color_rendering_attachment},
+                                depth_rendering_attachment,
+                                VkRect2D{VkOffset2D{}, {width, height}});
+  _context->cmd_bind_pipeline(cbuf, _visibility_pipeline);
+  // raygen shoots pixel i through ndc 2 * i / (width - 1) - 1, a viewport
+  // starting half a pixel in and one pixel narrower puts the pixel centers
+  // the rasterizer samples exactly there
+  VkViewport viewport{};
+  viewport.x = 0.5f;
+  viewport.y = 0.5f;
+  viewport.width = float(std::max(width, 2u) - 1);
+  viewport.height = float(std::max(height, 2u) - 1);
+  viewport.minDepth = 0.f;
+  viewport.maxDepth = 1.f;
+  _context->cmd_set_viewport_and_scissor(
+      cbuf, viewport, VkRect2D{VkOffset2D{}, {width, height}});
+  _context->cmd_bind_descriptor_sets(cbuf, _visibility_pipeline, 0,
+                                     {_base->_bindless_descriptor_set});
+  push_constant_visibility_t pc{};
+  pc.camera = gfx::to<camera_t *>(
+      _context->get_buffer_device_address(_camera_buffer));
+  pc.instances = gfx::to<bvh_instance_t *>(
+      _context->get_buffer_device_address(_instances_buffer));
+  for (uint32_t slot = 0; slot < _instances.size(); slot++) {
+    // paged out geometry is only bounds, resolve defers those pixels
+    if (!_instance_owners[slot].resident)
+      continue;
+    pc.instance = slot;
+    _context->cmd_push_constants(cbuf, _visibility_pipeline,
+                                 VK_SHADER_STAGE_ALL, 0,
+                                 sizeof(push_constant_visibility_t), &pc);
+    _context->cmd_draw(cbuf, _instance_owners[slot].index_count, 1, 0, 0);
+  }
+  _context->cmd_end_rendering(cbuf);
+  _gpu_timer->end(cbuf, "visibility");
+
+  _context->cmd_image_memory_barrier(
+      cbuf, _visibility_image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      VK_IMAGE_LAYOUT_GENERAL, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+      VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+}
+
+void renderer_t::write_instance(uint32_t slot, const mesh_t &mesh) {
+  _primary_hits_valid = false;
+  instance_owner_t &owner = _instance_owners[slot];
+  owner.lod = std::min<uint32_t>(owner.lod, mesh.lods.size());
+  // coarser levels are never compact or paged out
+  const mesh_lod_t *lod = owner.lod ? &mesh.lods[owner.lod - 1] : nullptr;
+  const bool root_is_leaf = lod ? lod->root_is_leaf : mesh.root_is_leaf;
+  if (owner.root_is_leaf != root_is_leaf) {
+    owner.root_is_leaf = root_is_leaf;
+    if (root_is_leaf)
+      _root_leaf_instances++;
+    else
+      _root_leaf_instances--;
+  }
+  if (owner.resident != mesh.resident) {
+    owner.resident = mesh.resident;
+    if (mesh.resident)
+      _non_resident_instances--;
+    else
+      _non_resident_instances++;
+  }
+  owner.index_count = lod ? lod->index_count : mesh.index_count;
+  bvh_instance_t &instance = _instances[slot];
+  instance = {};
+  instance.aabb = mesh.aabb;
+  instance.resident = mesh.resident;
+  if (lod) {
+    instance.vertices = gfx::to<core::vertex_t *>(
+        _context->get_buffer_device_address(lod->vertex_buffer));
+    instance.bvh_triangles = gfx::to<triangle_t *>(
+        _context->get_buffer_device_address(lod->bvh_triangles_buffer));
+    instance.indices = gfx::to<uint32_t *>(
+        _context->get_buffer_device_address(lod->index_buffer));
+    instance.nodes = gfx::to<core::bvh::node_t *>(
+        _context->get_buffer_device_address(lod->nodes_buffer));
+    instance.primitive_indices = gfx::to<uint32_t *>(
+        _context->get_buffer_device_address(lod->primitive_index_buffer));
+  } else if (!mesh.resident) {
+    // only the bounds are traced, hits request the geometry
+  } else if (mesh.compact_geometry) {
+    instance.compact_geometry = 1;
+    instance.compact_vertices = gfx::to<compact_vertex_t *>(
+        _context->get_buffer_device_address(mesh.vertex_buffer));
+    instance.compact_triangles = gfx::to<compact_triangle_t *>(
+        _context->get_buffer_device_address(mesh.bvh_triangles_buffer));
+    instance.quantization = mesh.quantization;
+  } else {
+    instance.vertices = gfx::to<core::vertex_t *>(
+        _context->get_buffer_device_address(mesh.vertex_buffer));
+    instance.bvh_triangles = gfx::to<triangle_t *>(
+        _context->get_buffer_device_address(mesh.bvh_triangles_buffer));
+  }
+  if (mesh.resident && !lod) {
+    instance.indices = gfx::to<uint32_t *>(
+        _context->get_buffer_device_address(mesh.index_buffer));
+    instance.nodes = gfx::to<core::bvh::node_t *>(
+        _context->get_buffer_device_address(mesh.nodes_buffer));
+    instance.primitive_indices = gfx::to<uint32_t *>(
+        _context->get_buffer_device_address(mesh.primitive_index_buffer));
+  }
+  instance.model = gfx::to<core::mat4 *>(
+      _context->get_buffer_device_address(mesh.model_buffer));
+  instance.inv_model = gfx::to<core::mat4 *>(
+      _context->get_buffer_device_address(mesh.inv_model_buffer));
+  instance.diffuse_bindless = mesh.material.diffuse_bindless;
+  _instances_dirty = true;
+}
+
+void renderer_t::select_lods(core::ref<ecs::scene_t<>> scene,
+                             const core::camera_t &camera, uint32_t height) {
+  const core::mat4 inv_view = core::inverse(camera.view);
+  const core::vec3 eye{inv_view[3][0], inv_view[3][1], inv_view[3][2]};
+  // pixels an object space unit covers at distance 1 per unit of scale
+  const float pixels_per_unit =
+      0.5f * float(height) * std::abs(camera.projection[1][1]);
+  for (uint32_t slot = 0; slot < _instances.size(); slot++) {
+    instance_owner_t &owner = _instance_owners[slot];
+    const mesh_t &mesh =
+        scene->get<model_t>(owner.id).meshes[owner.mesh_index];
+    if (mesh.lods.empty())
+      continue;
+    const core::mat4 model =
+        scene->has<core::transform_t>(owner.id)
+            ? scene->get<core::transform_t>(owner.id).mat4()
+            : core::mat4{1.f};
+    const float scale = std::max(
+        {core::length(core::vec3{model[0][0], model[0][1], model[0][2]}),
+         core::length(core::vec3{model[1][0], model[1][1], model[1][2]}),
+         core::length(core::vec3{model[2][0], model[2][1], model[2][2]})});
+    const core::vec4 center =
+        model * core::vec4((mesh.aabb.min + mesh.aabb.max) * 0.5f, 1.f);
+    const float radius =
+        0.5f * core::length(mesh.aabb.max - mesh.aabb.min) * scale;
+    // to the bounding sphere, full detail from inside it
+    const float distance =
+        core::length(core::vec3{center.x, center.y, center.z} - eye) - radius;
+
+    uint32_t lod = 0;
+    if (_lod_pixel_error > 0 && distance > 0)
+      while (lod < mesh.lods.size() &&
+             mesh.lods[lod].error * scale * pixels_per_unit / distance <=
+                 _lod_pixel_error)
+        lod++;
+    if (lod != owner.lod) {
+      owner.lod = lod;
+      write_instance(slot, mesh);
+    }
+  }
+}
+
+void renderer_t::write_instances(ecs::entity_id_t id, const model_t &model) {
+  auto &slots = _entity_slots[id];
+  for (uint32_t mesh_index = 0; mesh_index < slots.size(); mesh_index++)
+    write_instance(slots[mesh_index], model.meshes[mesh_index]);
+}
+
+void renderer_t::add_instances(ecs::entity_id_t id, const model_t &model) {
+  reserve_instances(_instances.size() + model.meshes.size());
+  auto &slots = _entity_slots[id];
+  for (uint32_t mesh_index = 0; mesh_index < model.meshes.size();
+       mesh_index++) {
+    uint32_t slot = _instances.size();
+    _instances.emplace_back();
+    _instance_owners.push_back(
+        instance_owner_t{.id = id, .mesh_index = mesh_index});
+    slots.push_back(slot);
+    write_instance(slot, model.meshes[mesh_index]);
+  }
+  _num_blas_instances = _instances.size();
+}
+
+void renderer_t::remove_instances(ecs::entity_id_t id) {
+  auto itr = _entity_slots.find(id);
+  if (itr == _entity_slots.end())
+    return;
+  std::vector<uint32_t> slots = std::move(itr->second);
+  _entity_slots.erase(itr);
+  _primary_hits_valid = false;
+  // highest slot first so the moved last slot is never one being removed
+  std::sort(slots.begin(), slots.end(), std::greater<uint32_t>());
+  for (uint32_t slot : slots) {
+    if (_instance_owners[slot].root_is_leaf)
+      _root_leaf_instances--;
+    if (!_instance_owners[slot].resident)
+      _non_resident_instances--;
+    uint32_t last = _instances.size() - 1;
+    if (slot != last) {
+      instance_owner_t owner = _instance_owners[last];
+      _instances[slot] = _instances[last];
+      _instance_owners[slot] = owner;
+      _entity_slots[owner.id][owner.mesh_index] = slot;
+    }
+    _instances.pop_back();
+    _instance_owners.pop_back();
+  }
+  _num_blas_instances = _instances.size();
+  _instances_dirty = true;
+}
+
+void renderer_t::reserve_buffer(gfx::handle_buffer_t &buffer,
+                                const gfx::config_buffer_t &cb) {
+  if (buffer != core::null_handle &&
+      _context->get_buffer(buffer).config.vk_size >= cb.vk_size)
+    return;
+  if (buffer != core::null_handle)
+    _context->destroy_buffer(buffer);
+  buffer = _context->create_buffer(cb);
+}
+
+void renderer_t::drop_sah_readbacks(ecs::entity_id_t id) {
+  for (auto &[key, uploads] : _frame_uploads)
+    std::erase_if(uploads.sah_readbacks,
+                  [&](const frame_uploads_t::sah_readback_t &readback) {
+                    return readback.id == id;
+                  });
+}
+
+void renderer_t::upload_transforms(core::ref<ecs::scene_t<>> scene,
+                                   gfx::handle_commandbuffer_t cbuf) {
+  // model then inverse model of every mesh of the entities that moved
+  std::vector<core::mat4> matrices{};
+  std::vector<gfx::handle_buffer_t> buffers{};
+  for (ecs::entity_id_t id : _dirty_transforms) {
+    if (!scene->has<model_t>(id))
+      continue;
+    _primary_hits_valid = false;
+    core::mat4 model = scene->has<core::transform_t>(id)
+                           ? scene->get<core::transform_t>(id).mat4()
+                           : core::mat4{1.f};
+    core::mat4 inv_model = core::inverse(model);
+    for (auto &mesh : scene->get<model_t>(id).meshes) {
+      matrices.push_back(model);
+      buffers.push_back(mesh.model_buffer);
+      matrices.push_back(inv_model);
+      buffers.push_back(mesh.inv_model_buffer);
+    }
+  }
+  _dirty_transforms.clear();
+  if (matrices.empty())
+    return;
+
+  gfx::handle_buffer_t &staging = _frame_uploads[cbuf.val].transforms;
+  gfx::config_buffer_t cb{};
+  cb.vk_size = matrices.size() * sizeof(core::mat4);
+  cb.vk_buffer_usage_flags = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  cb.vma_allocation_create_flags =
+      VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+  reserve_buffer(staging, cb);
+  std::memcpy(_context->map_buffer(staging), matrices.data(), cb.vk_size);
+
+  const uint32_t stages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                          VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+  // the previous frame's passes read the matrices before they are replaced
+  for (gfx::handle_buffer_t buffer : buffers)
+    _context->cmd_buffer_memory_barrier(
+        cbuf, buffer, sizeof(core::mat4), 0, VK_ACCESS_SHADER_READ_BIT,
+        VK_ACCESS_TRANSFER_WRITE_BIT, stages, VK_PIPELINE_STAGE_TRANSFER_BIT);
+  for (uint32_t i = 0; i < buffers.size(); i++)
+    _context->cmd_copy_buffer(cbuf, staging, buffers[i],
+                              VkBufferCopy{
+                                  .srcOffset = i * sizeof(core::mat4),
+                                  .dstOffset = 0,
+                                  .size = sizeof(core::mat4),
+                              });
+  for (gfx::handle_buffer_t buffer : buffers)
+    _context->cmd_buffer_memory_barrier(
+        cbuf, buffer, sizeof(core::mat4), 0, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, stages);
+}
+
+void renderer_t::upload_instances(gfx::handle_commandbuffer_t cbuf) {
+  if (!_instances_dirty || _instances.empty())
+    return;
+  _instances_dirty = false;
+  const size_t size = _instances.size() * sizeof(bvh_instance_t);
+  gfx::handle_buffer_t &staging = _frame_uploads[cbuf.val].instances;
+  gfx::config_buffer_t cb{};
+  cb.vk_size = _instances_capacity * sizeof(bvh_instance_t);
+  cb.vk_buffer_usage_flags = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  cb.vma_allocation_create_flags =
+      VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+  reserve_buffer(staging, cb);
+  std::memcpy(_context->map_buffer(staging), _instances.data(), size);
+
+  // the previous frame's passes read the slots before they are replaced
+  _context->cmd_buffer_memory_barrier(
+      cbuf, _instances_buffer, size, 0, VK_ACCESS_SHADER_READ_BIT,
+      VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT);
+  _context->cmd_copy_buffer(cbuf, staging, _instances_buffer,
+                            VkBufferCopy{
+                                .srcOffset = 0,
+                                .dstOffset = 0,
+                                .size = size,
+                            });
+  _context->cmd_buffer_memory_barrier(
+      cbuf, _instances_buffer, size, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+}
+
+void renderer_t::begin_residency(gfx::handle_commandbuffer_t cbuf) {
+  // base_t::begin waited for the last submission of cbuf, and the queries
+  // writing its flags were submitted before it
+  frame_uploads_t &uploads = _frame_uploads[cbuf.val];
+  _residency_flags.clear();
+  if (!uploads.residency_owners.empty()) {
+    invalidate_buffer(uploads.residency);
+    const uint32_t *flags = reinterpret_cast<const uint32_t *>(
+        _context->map_buffer(uploads.residency));
+    for (uint32_t slot = 0; slot < uploads.residency_owners.size(); slot++)
+      _residency_flags.push_back(residency_flags_t{
+          .id = uploads.residency_owners[slot].first,
+          .mesh_index = uploads.residency_owners[slot].second,
+          .used = flags[2 * slot + 0],
+          .requested = flags[2 * slot + 1],
+      });
+  }
+  gfx::config_buffer_t cb{};
+  cb.vk_size = 2 * _instances_capacity * sizeof(uint32_t);
+  cb.vk_buffer_usage_flags =
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  cb.vma_allocation_create_flags =
+      VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT;
+  reserve_buffer(uploads.residency, cb);
+  _residency_buffer = uploads.residency;
+  _residency_cleared = false;
+}
+
+void renderer_t::clear_residency(gfx::handle_commandbuffer_t cbuf) {
+  if (!_residency_cleared) {
+    _residency_cleared = true;
+    _context->cmd_copy_buffer(
+        cbuf, _residency_clear_buffer, _residency_buffer,
+        VkBufferCopy{
+            .srcOffset = 0,
+            .dstOffset = 0,
+            .size = 2 * _instances_capacity * sizeof(uint32_t),
+        });
+  }
+  // also orders the frame's trace after a query submission that cleared it
+  _context->cmd_buffer_memory_barrier(
+      cbuf, _residency_buffer,
+      _context->get_buffer(_residency_buffer).config.vk_size, 0,
+      VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+}
+
+void renderer_t::update_residency(core::ref<ecs::scene_t<>> scene,
+                                  gfx::handle_commandbuffer_t cbuf) {
+  frame_uploads_t &uploads = _frame_uploads[cbuf.val];
+  // slots the frame's trace writes flags for
+  uploads.residency_owners.clear();
+  for (const instance_owner_t &owner : _instance_owners)
+    uploads.residency_owners.emplace_back(owner.id, owner.mesh_index);
+  if (_context->get_buffer(_residency_buffer).config.vk_size <
+      2 * _instances_capacity * sizeof(uint32_t)) {
+    // instances were added, queries already submitted this frame may still
+    // write the old flags, theirs are lost and asked for again
+    uploads.retired.push_back(uploads.residency);
+    gfx::config_buffer_t cb{};
+    cb.vk_size = 2 * _instances_capacity * sizeof(uint32_t);
+    cb.vk_buffer_usage_flags =
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    cb.vma_allocation_create_flags =
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT;
+    uploads.residency = _context->create_buffer(cb);
+    _residency_buffer = uploads.residency;
+    _residency_cleared = false;
+  }
+  clear_residency(cbuf);
+
+  if (_last_frame_traced)
+    _frame++;
+  if (_instances.empty())
+    return;
+
+  auto mesh_of = [&](uint32_t slot) -> mesh_t & {
+    const instance_owner_t &owner = _instance_owners[slot];
+    return scene->get<model_t>(owner.id).meshes[owner.mesh_index];
+  };
+
+  // flags of a frame a few frames old, by mesh since slots move
+  std::vector<uint32_t> requests{};
+  for (const residency_flags_t &flags : _residency_flags) {
+    auto itr = _entity_slots.find(flags.id);
+    if (itr == _entity_slots.end())
+      continue;
+    const uint32_t slot = itr->second[flags.mesh_index];
+    mesh_t &mesh = mesh_of(slot);
+    if (flags.used)
+      mesh.last_used_frame = _frame;
+    if (flags.requested && !mesh.resident && mesh.host_geometry.size())
+      requests.push_back(slot);
+  }
+  _residency_flags.clear();
+
+  std::vector<uint32_t> candidates{};
+  size_t resident_size = 0;
+  for (uint32_t slot = 0; slot < _instances.size(); slot++) {
+    mesh_t &mesh = mesh_of(slot);
+    if (!mesh.host_geometry.size() || !mesh.resident)
+      continue;
+    resident_size += mesh.host_geometry.size();
+    if (mesh.last_used_frame + _residency_min_age < _frame)
+      candidates.push_back(slot);
+  }
+  _resident_geometry_size = resident_size;
+
+  const size_t budget = size_t(_residency_budget_mb) * 1024 * 1024;
+  if (budget == 0 && requests.empty())
+    return;
+
+  // least recently used first, only as much as the budget needs
+  size_t requested_size = 0;
+  for (uint32_t slot : requests)
+    requested_size += mesh_of(slot).host_geometry.size();
+  std::sort(candidates.begin(), candidates.end(),
+            [&](uint32_t a, uint32_t b) {
+              return mesh_of(a).last_used_frame < mesh_of(b).last_used_frame;
+            });
+  std::vector<uint32_t> evictions{};
+  for (uint32_t slot : candidates) {
+    if (budget == 0 || resident_size + requested_size <= budget)
+      break;
+    evictions.push_back(slot);
+    resident_size -= mesh_of(slot).host_geometry.size();
+  }
+  for (uint32_t slot : evictions) {
+    // frames in flight may still be traversing the evicted geometry
+    for (gfx::handle_buffer_t buffer : evict_geometry(mesh_of(slot)))
+      uploads.retired.push_back(buffer);
+    write_instance(slot, mesh_of(slot));
+  }
+
+  // requests that do not fit stay deferred until something ages out
+  for (uint32_t slot : requests) {
+    mesh_t &mesh = mesh_of(slot);
+    if (budget != 0 && resident_size + mesh.host_geometry.size() > budget)
+      continue;
+    page_in_geometry(_base, mesh);
+    mesh.last_used_frame = _frame;
+    resident_size += mesh.host_geometry.size();
+    write_instance(slot, mesh);
+  }
+  _resident_geometry_size = resident_size;
+}
+
+void renderer_t::update_vertices(ecs::entity_id_t id, uint32_t mesh_index,
+                                 std::vector<core::vertex_t> vertices) {
+  _refit_requests.push_back(refit_request_t{
+      .id = id, .mesh_index = mesh_index, .vertices = std::move(vertices)});
+}
+
+void renderer_t::refit(core::ref<ecs::scene_t<>> scene,
+                       gfx::handle_commandbuffer_t cbuf) {
+  // costs of the refits cbuf recorded the last time around, base_t::begin
+  // waited for that submission before handing it out again
+  frame_uploads_t &uploads = _frame_uploads[cbuf.val];
+  if (!uploads.sah_readbacks.empty()) {
+    invalidate_buffer(uploads.sah);
+    const float *costs =
+        reinterpret_cast<const float *>(_context->map_buffer(uploads.sah));
+    for (auto &readback : uploads.sah_readbacks)
+      if (scene->has<model_t>(readback.id))
+        scene->get<model_t>(readback.id)
+            .meshes[readback.mesh_index]
+            .refit_sah_cost = costs[readback.index];
+    uploads.sah_readbacks.clear();
+  }
+
+  // swap in finished background rebuilds, they were built from older vertices
+  // so they get refitted to the latest ones below
+  for (auto itr = _rebuilds.begin(); itr != _rebuilds.end();) {
+    if (itr->bvh.wait_for(std::chrono::seconds(0)) !=
+        std::future_status::ready) {
+      itr++;
+      continue;
+    }
+    core::bvh::bvh_t bvh = itr->bvh.get();
+    if (scene->has<model_t>(itr->id)) {
+      mesh_t &mesh = scene->get<model_t>(itr->id).meshes[itr->mesh_index];
+      // frames in flight may still be traversing the old tree
+      uploads.retired.push_back(mesh.nodes_buffer);
+      uploads.retired.push_back(mesh.primitive_index_buffer);
+      uploads.retired.push_back(mesh.refit_order_buffer);
+      upload_bvh(_base, mesh, bvh);
+      // costs still in flight belong to the old tree
+      drop_sah_readbacks(itr->id);
+      write_instances(itr->id, scene->get<model_t>(itr->id));
+      _refit_requests.push_back(refit_request_t{.id = itr->id,
+                                                .mesh_index = itr->mesh_index,
+                                                .vertices = mesh.vertices});
+    }
+    itr = _rebuilds.erase(itr);
+  }
+
+  if (_refit_requests.empty())
+    return;
+
+  // frames in flight still read the vertex buffers, the new vertices go
+  // through staging buffers of cbuf and copies recorded below
+  size_t vertices_size = 0;
+  uint32_t refit_count = 0;
+  for (auto &request : _refit_requests) {
+    if (!scene->has<model_t>(request.id))
+      continue;
+    vertices_size += request.vertices.size() * sizeof(core::vertex_t);
+    refit_count++;
+  }
+  if (refit_count == 0) {
+    _refit_requests.clear();
+    return;
+  }
+  gfx::config_buffer_t cb{};
+  cb.vk_size = vertices_size;
+  cb.vk_buffer_usage_flags = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  cb.vma_allocation_create_flags =
+      VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+  reserve_buffer(uploads.vertices, cb);
+  cb.vk_size = refit_count * sizeof(float);
+  cb.vk_buffer_usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  cb.vma_allocation_create_flags =
+      VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT;
+  reserve_buffer(uploads.sah, cb);
+  uint8_t *staged_vertices =
+      reinterpret_cast<uint8_t *>(_context->map_buffer(uploads.vertices));
+  size_t vertices_offset = 0;
+
+  _gpu_timer->start(cbuf, "refit");
+  for (auto &request : _refit_requests) {
+    if (!scene->has<model_t>(request.id))
+      continue;
+    mesh_t &mesh = scene->get<model_t>(request.id).meshes[request.mesh_index];
+    assert(mesh.deformable && "only deformable meshes can be refitted");
+    assert(request.vertices.size() == mesh.vertex_count);
+
+    // read back from the last refit of this mesh, a few frames old at most
+    const float refit_sah_cost = mesh.refit_sah_cost;
+    bool rebuilding =
+        std::any_of(_rebuilds.begin(), _rebuilds.end(), [&](auto &rebuild) {
+          return rebuild.id == request.id &&
+                 rebuild.mesh_index == request.mesh_index;
+        });
+    if (!rebuilding &&
+        refit_sah_cost > mesh.build_sah_cost * _rebuild_sah_threshold) {
+      _rebuilds.push_back(rebuild_t{
+          .id = request.id,
+          .mesh_index = request.mesh_index,
+          .bvh = _loader.submit([this, vertices = request.vertices,
+                                 indices = mesh.indices,
+                                 options = mesh.bvh_options]() {
+            return build_bvh(extract_triangles(vertices, indices), options,
+                             &_loader);
+          }),
+      });
+    }
+
+    const size_t size = request.vertices.size() * sizeof(core::vertex_t);
+    std::memcpy(staged_vertices + vertices_offset, request.vertices.data(),
+                size);
+    const VkDeviceSize vertex_buffer_size =
+        _context->get_buffer(mesh.vertex_buffer).config.vk_size;
+    _context->cmd_buffer_memory_barrier(
+        cbuf, mesh.vertex_buffer, vertex_buffer_size, 0,
+        VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT);
+    _context->cmd_copy_buffer(cbuf, uploads.vertices, mesh.vertex_buffer,
+                              VkBufferCopy{
+                                  .srcOffset = vertices_offset,
+                                  .dstOffset = 0,
+                                  .size = size,
+                              });
+    _context->cmd_buffer_memory_barrier(
+        cbuf, mesh.vertex_buffer, vertex_buffer_size, 0,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    vertices_offset += size;
+    mesh.vertices = std::move(request.vertices);
+    // instance bounds cull rays before the blas, keep them current
+    mesh.aabb = {};
+    for (auto &vertex : mesh.vertices)
+      mesh.aabb.grow(vertex.position);
+    write_instance(_entity_slots[request.id][request.mesh_index], mesh);
+
+    push_constant_refit_t pc{};
+    pc.vertices = gfx::to<core::vertex_t *>(
+        _context->get_buffer_device_address(mesh.vertex_buffer));
+    pc.indices = gfx::to<uint32_t *>(
+        _context->get_buffer_device_address(mesh.index_buffer));
+    pc.bvh_triangles = gfx::to<triangle_t *>(
+        _context->get_buffer_device_address(mesh.bvh_triangles_buffer));
+    pc.nodes = gfx::to<core::bvh::node_t *>(
+        _context->get_buffer_device_address(mesh.nodes_buffer));
+    pc.primitive_indices = gfx::to<uint32_t *>(
+        _context->get_buffer_device_address(mesh.primitive_index_buffer));
+    pc.refit_order = gfx::to<uint32_t *>(
+        _context->get_buffer_device_address(mesh.refit_order_buffer));
+    const uint32_t sah_index = uploads.sah_readbacks.size();
+    pc.sah = gfx::to<float *>(
+        _context->get_buffer_device_address(uploads.sah) +
+        sah_index * sizeof(float));
+    pc.node_intersection_cost =
+        mesh.bvh_options.options.o_node_intersection_cost;
+    pc.primitive_intersection_cost =
+        mesh.bvh_options.options.o_primitive_intersection_cost;
+
+    pc.offset = 0;
+    pc.count = mesh.index_count / 3;
+    _context->cmd_bind_pipeline(cbuf, _refit_triangles_pipeline);
+    _context->cmd_bind_descriptor_sets(cbuf, _refit_triangles_pipeline, 0,
+                                       {_base->_bindless_descriptor_set});
+    _context->cmd_push_constants(cbuf, _refit_triangles_pipeline,
+                                 VK_SHADER_STAGE_ALL, 0,
+                                 sizeof(push_constant_refit_t), &pc);
+    _context->cmd_dispatch(cbuf, (pc.count + 64 - 1) / 64, 1, 1);
+    _context->cmd_buffer_memory_barrier(
+        cbuf, mesh.bvh_triangles_buffer,
+        _context->get_buffer(mesh.bvh_triangles_buffer).config.vk_size, 0,
+        VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+    _context->cmd_bind_pipeline(cbuf, _refit_nodes_pipeline);
+    _context->cmd_bind_descriptor_sets(cbuf, _refit_nodes_pipeline, 0,
+                                       {_base->_bindless_descriptor_set});
+    for (uint32_t level = 0; level + 1 < mesh.refit_level_offsets.size();
+         level++) {
+      pc.offset = mesh.refit_level_offsets[level];
+      pc.count = mesh.refit_level_offsets[level + 1] - pc.offset;
+      _context->cmd_push_constants(cbuf, _refit_nodes_pipeline,
+                                   VK_SHADER_STAGE_ALL, 0,
+                                   sizeof(push_constant_refit_t), &pc);
+      _context->cmd_dispatch(cbuf, (pc.count + 64 - 1) / 64, 1, 1);
+      _context->cmd_buffer_memory_barrier(
+          cbuf, mesh.nodes_buffer,
+          _context->get_buffer(mesh.nodes_buffer).config.vk_size, 0,
+          VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    }
+
+    pc.offset = 0;
+    pc.count = mesh.refit_level_offsets.back();
+    _context->cmd_bind_pipeline(cbuf, _refit_sah_pipeline);
+    _context->cmd_bind_descriptor_sets(cbuf, _refit_sah_pipeline, 0,
+                                       {_base->_bindless_descriptor_set});
+    _context->cmd_push_constants(cbuf, _refit_sah_pipeline,
+                                 VK_SHADER_STAGE_ALL, 0,
+                                 sizeof(push_constant_refit_t), &pc);
+    _context->cmd_dispatch(cbuf, 1, 1, 1);
+    _context->cmd_buffer_memory_barrier(
+        cbuf, uploads.sah, sizeof(float), sah_index * sizeof(float),
+        VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT);
+    uploads.sah_readbacks.push_back(
+        frame_uploads_t::sah_readback_t{.id = request.id,
+                                        .mesh_index = request.mesh_index,
+                                        .index = sah_index});
+  }
+  _gpu_timer->end(cbuf, "refit");
+  _refit_requests.clear();
+}
+
+void renderer_t::reserve_lbvh_scratch(uint32_t triangle_count) {
+  if (triangle_count <= _lbvh_scratch_capacity)
+    return;
+  if (_lbvh_scratch_buffer != core::null_handle) {
+    // earlier frames may still be building with the old scratch
+    _context->wait_idle();
+    _context->destroy_buffer(_lbvh_scratch_buffer);
+  }
+  _lbvh_scratch_capacity = std::max(triangle_count, _lbvh_scratch_capacity * 2);
+  const uint32_t block_count =
+      (_lbvh_scratch_capacity + lbvh_block_size - 1) / lbvh_block_size;
+
+  gfx::config_buffer_t cb{};
+  cb.vk_buffer_usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  cb.vma_allocation_create_flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+  // bounds, 2 key and 2 value arrays, histograms, 4 per node arrays
+  cb.vk_size = 8 * sizeof(float) +
+               8 * _lbvh_scratch_capacity * sizeof(uint32_t) +
+               256 * block_count * sizeof(uint32_t);
+  _lbvh_scratch_buffer = _context->create_buffer(cb);
+}
+
+void renderer_t::build_bvhs(core::ref<ecs::scene_t<>> scene,
+                            gfx::handle_commandbuffer_t cbuf) {
+  if (_bvh_build_requests.empty())
+    return;
+
+  uint32_t max_triangle_count = 0;
+  for (auto &request : _bvh_build_requests) {
+    if (!scene->has<model_t>(request.id))
+      continue;
+    const mesh_t &mesh =
+        scene->get<model_t>(request.id).meshes[request.mesh_index];
+    max_triangle_count = std::max(max_triangle_count, mesh.index_count / 3);
+  }
+  reserve_lbvh_scratch(max_triangle_count);
+
+  auto dispatch = [&](gfx::handle_pipeline_t pipeline, const void *pc,
+                      size_t size, uint32_t group_count) {
+    _context->cmd_bind_pipeline(cbuf, pipeline);
+    _context->cmd_bind_descriptor_sets(cbuf, pipeline, 0,
+                                       {_base->_bindless_descriptor_set});
+    _context->cmd_push_constants(cbuf, pipeline, VK_SHADER_STAGE_ALL, 0, size,
+                                 pc);
+    _context->cmd_dispatch(cbuf, group_count, 1, 1);
+  };
+  auto barrier = [&](gfx::handle_buffer_t buffer) {
+    _context->cmd_buffer_memory_barrier(
+        cbuf, buffer, _context->get_buffer(buffer).config.vk_size, 0,
+        VK_ACCESS_SHADER_WRITE_BIT,
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+  };
+
+  _gpu_timer->start(cbuf, "lbvh");
+  for (auto &request : _bvh_build_requests) {
+    if (!scene->has<model_t>(request.id))
+      continue;
+    mesh_t &mesh = scene->get<model_t>(request.id).meshes[request.mesh_index];
+    const uint32_t triangle_count = mesh.index_count / 3;
+    if (triangle_count == 0)
+      continue;
+
+    // triangles from the uploaded vertices, same pass refit uses
+    push_constant_refit_t refit_pc{};
+    refit_pc.vertices = gfx::to<core::vertex_t *>(
+        _context->get_buffer_device_address(mesh.vertex_buffer));
+    refit_pc.indices = gfx::to<uint32_t *>(
+        _context->get_buffer_device_address(mesh.index_buffer));
+    refit_pc.bvh_triangles = gfx::to<triangle_t *>(
+        _context->get_buffer_device_address(mesh.bvh_triangles_buffer));
+    refit_pc.count = triangle_count;
+    dispatch(_refit_triangles_pipeline, &refit_pc,
+             sizeof(push_constant_refit_t), (triangle_count + 64 - 1) / 64);
+    barrier(mesh.bvh_triangles_buffer);
+
+    push_constant_lbvh_t pc{};
+    pc.count = triangle_count;
+    pc.block_count = (triangle_count + lbvh_block_size - 1) / lbvh_block_size;
+    pc.bvh_triangles = refit_pc.bvh_triangles;
+    pc.nodes = gfx::to<core::bvh::node_t *>(
+        _context->get_buffer_device_address(mesh.nodes_buffer));
+    pc.primitive_indices = gfx::to<uint32_t *>(
+        _context->get_buffer_device_address(mesh.primitive_index_buffer));
+    // scratch sections are laid out for the capacity, not this mesh
+    uint8_t *scratch = gfx::to<uint8_t *>(
+        _context->get_buffer_device_address(_lbvh_scratch_buffer));
+    const size_t array_size = _lbvh_scratch_capacity * sizeof(uint32_t);
+    pc.bounds = reinterpret_cast<float *>(scratch);
+    scratch += 8 * sizeof(float);
+    uint32_t *keys[2], *values[2];
+    for (uint32_t i = 0; i < 2; i++) {
+      keys[i] = reinterpret_cast<uint32_t *>(scratch);
+      scratch += array_size;
+      values[i] = reinterpret_cast<uint32_t *>(scratch);
+      scratch += array_size;
+    }
+    pc.parents = reinterpret_cast<uint32_t *>(scratch);
+    scratch += array_size;
+    pc.leaf_parents = reinterpret_cast<uint32_t *>(scratch);
+    scratch += array_size;
+    pc.internal_slots = reinterpret_cast<uint32_t *>(scratch);
+    scratch += array_size;
+    pc.counters = reinterpret_cast<uint32_t *>(scratch);
+    scratch += array_size;
+    pc.block_histograms = reinterpret_cast<uint32_t *>(scratch);
+    pc.keys_in = keys[0];
+    pc.values_in = values[0];
+    pc.keys_out = keys[1];
+    pc.values_out = values[1];
+
+    dispatch(_lbvh_bounds_pipeline, &pc, sizeof(pc), 1);
+    barrier(_lbvh_scratch_buffer);
+    dispatch(_lbvh_morton_pipeline, &pc, sizeof(pc),
+             (triangle_count + 64 - 1) / 64);
+    barrier(_lbvh_scratch_buffer);
+
+    // 8 bit digits, the keys end up back in keys[0] after the 4 passes
+    for (pc.shift = 0; pc.shift < 32; pc.shift += 8) {
+      dispatch(_lbvh_histogram_pipeline, &pc, sizeof(pc), pc.block_count);
+      barrier(_lbvh_scratch_buffer);
+      dispatch(_lbvh_scan_pipeline, &pc, sizeof(pc), 1);
+      barrier(_lbvh_scratch_buffer);
+      dispatch(_lbvh_scatter_pipeline, &pc, sizeof(pc), pc.block_count);
+      barrier(_lbvh_scratch_buffer);
+      std::swap(pc.keys_in, pc.keys_out);
+      std::swap(pc.values_in, pc.values_out);
+    }
+
+    dispatch(_lbvh_hierarchy_pipeline, &pc, sizeof(pc),
+             (std::max(triangle_count - 1, 1u) + 64 - 1) / 64);
+    barrier(_lbvh_scratch_buffer);
+    barrier(mesh.nodes_buffer);
+    dispatch(_lbvh_aabbs_pipeline, &pc, sizeof(pc),
+             (triangle_count + 64 - 1) / 64);
+    barrier(mesh.nodes_buffer);
+    barrier(mesh.primitive_index_buffer);
+  }
+  _gpu_timer->end(cbuf, "lbvh");
+  _bvh_build_requests.clear();
+}
+
+void renderer_t::update_scene(core::ref<ecs::scene_t<>> scene,
+                              gfx::handle_commandbuffer_t cbuf) {
+  // base_t::begin waited for the last submission of cbuf and so for every
+  // submission before it, nothing still reads what it retired
+  frame_uploads_t &uploads = _frame_uploads[cbuf.val];
+  for (gfx::handle_buffer_t buffer : uploads.retired)
+    _context->destroy_buffer(buffer);
+  uploads.retired.clear();
+  uploads.retired_models.clear();
+
+  begin_residency(cbuf);
+  // behind the last frame's submission, its uploads and builds run first
+  submit_ray_queries();
+  poll_ray_queries(false);
+
+  for (ecs::entity_id_t id : _removed_entities) {
+    // a model still being prepared is dropped once its task finishes
+    std::erase_if(_pending_models,
+                  [&](const pending_model_t &pending) {
+                    return pending.id == id;
+                  });
+    remove_instances(id);
+    drop_sah_readbacks(id);
+    _dirty_transforms.erase(id);
+    _bvh_reports.erase(id);
+    if (scene->has<model_t>(id)) {
+      // frames in flight may still be traversing its geometry
+      uploads.retired_models.push_back(std::move(scene->get<model_t>(id)));
+      scene->remove<model_t>(id);
+    }
+  }
+  _removed_entities.clear();
+
+  for (ecs::entity_id_t id : _added_entities) {
+    if (scene->has<model_t>(id) ||
+        std::any_of(_pending_models.begin(), _pending_models.end(),
+                    [&](const pending_model_t &pending) {
+                      return pending.id == id;
+                    }))
+      continue;
+    model_options_t options = scene->has<model_options_t>(id)
+                                  ? scene->get<model_options_t>(id)
+                                  : model_options_t{};
+    // the tasks own copies, the scene may change while they run
+    if (scene->has<core::raw_model_t>(id))
+      _pending_models.push_back(pending_model_t{
+          .id = id,
+          .model = _loader.submit(
+              [this, raw_model = scene->get<core::raw_model_t>(id),
+               options]() {
+                return prepare_model(raw_model, _photon_assets_path, options,
+                                     &_loader, &_texture_cache);
+              }),
+      });
+    else if (scene->has<model_source_t>(id))
+      _pending_models.push_back(pending_model_t{
+          .id = id,
+          .model = _loader.submit(
+              [this, path = scene->get<model_source_t>(id).path, options]() {
+                return prepare_model(core::load_model_from_path(path),
+                                     _photon_assets_path, options, &_loader,
+                                     &_texture_cache);
+              }),
+      });
+  }
+  _added_entities.clear();
+
+  // one upload per frame, a burst of finished models would stall it again
+  auto ready = std::find_if(
+      _pending_models.begin(), _pending_models.end(),
+      [](pending_model_t &pending) {
+        return pending.model.wait_for(std::chrono::seconds(0)) ==
+               std::future_status::ready;
+      });
+  if (ready != _pending_models.end()) {
+    ecs::entity_id_t id = ready->id;
+    prepared_model_t prepared = ready->model.get();
+    _pending_models.erase(ready);
+    if (prepared.bvh_report) {
+      auto &reports = _bvh_reports[id];
+      for (auto &mesh : prepared.meshes)
+        reports.push_back(mesh.bvh_report);
+    }
+    scene->construct<model_t>(id) = upload_model(_base, std::move(prepared));
+    add_instances(id, scene->get<model_t>(id));
+    _dirty_transforms.insert(id);
+    auto &meshes = scene->get<model_t>(id).meshes;
+    for (uint32_t mesh_index = 0; mesh_index < meshes.size(); mesh_index++) {
+      meshes[mesh_index].last_used_frame = _frame;
+      if (meshes[mesh_index].bvh_options.gpu_build &&
+          !meshes[mesh_index].deformable)
+        _bvh_build_requests.push_back(
+            bvh_build_request_t{.id = id, .mesh_index = mesh_index});
+    }
+  }
+
+  upload_transforms(scene, cbuf);
+
+  update_residency(scene, cbuf);
+  build_bvhs(scene, cbuf);
+  refit(scene, cbuf);
+}
+
+gfx::handle_image_view_t renderer_t::render(core::ref<ecs::scene_t<>> scene,
+                                            const core::camera_t &camera) {
   auto cbuf = _base->current_commandbuffer();
 
+  apply_settings();
+  update_scene(scene, cbuf);
+
+  // draw
+
   camera_t shader_camera{};
   shader_camera.view = camera.view;
   shader_camera.projection = camera.projection;
   shader_camera.inv_view = core::inverse(shader_camera.view);
   shader_camera.inv_projection = core::inverse(shader_camera.projection);
+  if (!_has_prev_camera) {
+    _prev_view = camera.view;
+    _prev_projection = camera.projection;
+    _has_prev_camera = true;
+  }
+  shader_camera.prev_view = _prev_view;
+  shader_camera.prev_projection = _prev_projection;
+  _prev_view = camera.view;
+  _prev_projection = camera.projection;
   std::memcpy(_context->map_buffer(_camera_buffer), &shader_camera,
               sizeof(camera_t));
 
@@ -356,31 +1866,26 @@ gfx::handle_image_view_t renderer_t::render(core::ref<ecs::scene_t<>> scene,
     pc.camera = gfx::to<camera_t *>(
         _context->get_buffer_device_address(_camera_buffer));
 
-    scene->for_all<model_t, core::transform_t>(
-        [&](auto, const model_t &model, const core::transform_t &transform) {
-          for (auto &mesh : model.meshes) {
-            pc.vertices = gfx::to<core::vertex_t *>(
-                _context->get_buffer_device_address(mesh.vertex_buffer));
-            pc.indices = gfx::to<uint32_t *>(
-                _context->get_buffer_device_address(mesh.index_buffer));
-            pc.model = gfx::to<core::mat4 *>(
-                _context->get_buffer_device_address(mesh.model_buffer));
-            pc.inv_model = gfx::to<core::mat4 *>(
-                _context->get_buffer_device_address(mesh.inv_model_buffer));
-            pc.diffuse_bindless = mesh.material.diffuse_bindless.val;
-            core::mat4 model = transform.mat4();
-            core::mat4 inv_model = core::inverse(model);
-            // TODO: add this to context
-            std::memcpy(_context->map_buffer(mesh.model_buffer), &model,
-                        sizeof(core::mat4));
-            std::memcpy(_context->map_buffer(mesh.inv_model_buffer), &inv_model,
-                        sizeof(core::mat4));
-            _context->cmd_push_constants(cbuf, _debug_diffuse_pipeline,
-                                         VK_SHADER_STAGE_ALL, 0,
-                                         sizeof(push_constant_raster_t), &pc);
-            _context->cmd_draw(cbuf, mesh.index_count, 1, 0, 0);
-          }
-        });
+    scene->for_all<model_t>([&](auto, const model_t &model) {
+      for (auto &mesh : model.meshes) {
+        // the raster shaders only read full precision vertices
+        if (mesh.compact_geometry)
+          continue;
+        pc.vertices = gfx::to<core::vertex_t *>(
+            _context->get_buffer_device_address(mesh.vertex_buffer));
+        pc.indices = gfx::to<uint32_t *>(
+            _context->get_buffer_device_address(mesh.index_buffer));
+        pc.model = gfx::to<core::mat4 *>(
+            _context->get_buffer_device_address(mesh.model_buffer));
+        pc.inv_model = gfx::to<core::mat4 *>(
+            _context->get_buffer_device_address(mesh.inv_model_buffer));
+        pc.diffuse_bindless = mesh.material.diffuse_bindless.val;
+        _context->cmd_push_constants(cbuf, _debug_diffuse_pipeline,
+                                     VK_SHADER_STAGE_ALL, 0,
+                                     sizeof(push_constant_raster_t), &pc);
+        _context->cmd_draw(cbuf, mesh.index_count, 1, 0, 0);
+      }
+    });
     _context->cmd_end_rendering(cbuf);
 
     _context->cmd_image_memory_barrier(
@@ -398,14 +1903,90 @@ gfx::handle_image_view_t renderer_t::render(core::ref<ecs::scene_t<>> scene,
         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
   }
 
-  // raytracing pass
+  // raytracing pass, rendered at _render_scale and upscaled to the output
+  update_render_scale();
+  const uint32_t render_width = std::clamp<uint32_t>(
+      uint32_t(_width * _render_scale + 0.5f), 1, _max_width);
+  const uint32_t render_height = std::clamp<uint32_t>(
+      uint32_t(_height * _render_scale + 0.5f), 1, _max_height);
+  select_lods(scene, camera, render_height);
+  upload_instances(cbuf);
   {
+    _context->cmd_image_memory_barrier(
+        cbuf, _render_image, VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_IMAGE_LAYOUT_GENERAL, 0, VK_ACCESS_SHADER_WRITE_BIT,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    for (gfx::handle_image_t aov_image : _aov_images)
+      if (aov_image != core::null_handle)
+        _context->cmd_image_memory_barrier(
+            cbuf, aov_image, VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_GENERAL, 0, VK_ACCESS_SHADER_WRITE_BIT,
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
     _context->cmd_image_memory_barrier(
         cbuf, _raytrace_image, VK_IMAGE_LAYOUT_UNDEFINED,
         VK_IMAGE_LAYOUT_GENERAL, 0, VK_ACCESS_SHADER_WRITE_BIT,
         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
 
+    // permutations for the current settings, compiled on first use
+    const gfx::handle_pipeline_t trace_pipeline =
+        _hybrid_primary
+            ? permutation_pipeline(
+                  "resolve", _trace_pipeline_layout,
+                  {
+                      {"PHOTON_PAGING", _non_resident_instances ? "1" : "0"},
+                      {"PHOTON_SOA", _soa_rays ? "1" : "0"},
+                      {"PHOTON_COMPACT_RAYS", _compact_rays ? "1" : "0"},
+                  })
+            : permutation_pipeline(
+                  "trace", _trace_pipeline_layout,
+                  {
+                      {"PHOTON_STATS",
+                       _debug_view != debug_view_t::e_none ? "1" : "0"},
+                      {"PHOTON_STACK_SIZE", std::to_string(_stack_size)},
+                      {"PHOTON_ROOT_LEAF", _root_leaf_instances ? "1" : "0"},
+                      {"PHOTON_VALIDATION", _validation ? "1" : "0"},
+                      {"PHOTON_CULLING", _cull_instances ? "1" : "0"},
+                      {"PHOTON_WAVE_TRAVERSAL", _wave_traversal ? "1" : "0"},
+                      {"PHOTON_SOA", _soa_rays ? "1" : "0"},
+                      {"PHOTON_COMPACT_RAYS", _compact_rays ? "1" : "0"},
+                  });
+    const gfx::handle_pipeline_t shade_pipeline = permutation_pipeline(
+        "shade", _shade_pipeline_layout,
+        {
+            {"PHOTON_DEBUG_VIEW", std::to_string(uint32_t(_debug_view))},
+            {"PHOTON_VALIDATION", _validation ? "1" : "0"},
+            {"PHOTON_AOVS", std::to_string(_active_aovs)},
+            {"PHOTON_SOA", _soa_rays ? "1" : "0"},
+            {"PHOTON_COMPACT_RAYS", _compact_rays ? "1" : "0"},
+        });
+    const gfx::handle_pipeline_t raygen_pipeline = permutation_pipeline(
+        "raygen", _raygen_pipeline_layout,
+        {
+            {"PHOTON_SOA", _soa_rays ? "1" : "0"},
+            {"PHOTON_COMPACT_RAYS", _compact_rays ? "1" : "0"},
+        });
+
+    // only shade reruns while nothing the primary rays depend on changed
+    const bool trace_primary =
+        !_reuse_primary_hits || !_primary_hits_valid ||
+        trace_pipeline != _traced_pipeline ||
+        render_width != _render_width || render_height != _render_height ||
+        std::memcmp(&camera.view, &_traced_view, sizeof(core::mat4)) ||
+        std::memcmp(&camera.projection, &_traced_projection,
+                    sizeof(core::mat4));
+    if (trace_primary) {
+      _primary_hits_valid = true;
+      _traced_pipeline = trace_pipeline;
+      _traced_view = camera.view;
+      _traced_projection = camera.projection;
+    }
+    _last_frame_traced = trace_primary;
+    _render_width = render_width;
+    _render_height = render_height;
+
     // uint32_t width;
     // uint32_t height;
     // ray_data_t *ray_data;              // ray_data_t[width * height]
@@ -416,8 +1997,8 @@ gfx::handle_image_view_t renderer_t::render(core::ref<ecs::scene_t<>> scene,
     // bvh_instance_t *instances;         //
     // hit_t *hits;                       // hit_t[width * height]
     push_constant_raytracing_t pc{};
-    pc.width = _width;
-    pc.height = _height;
+    pc.width = render_width;
+    pc.height = render_height;
     pc.ray_data = gfx::to<ray_data_t *>(
         _context->get_buffer_device_address(_ray_data_buffer));
     pc.camera = gfx::to<camera_t *>(
@@ -430,16 +2011,51 @@ gfx::handle_image_view_t renderer_t::render(core::ref<ecs::scene_t<>> scene,
         _context->get_buffer_device_address(_instances_buffer));
     pc.hits =
         gfx::to<hit_t *>(_context->get_buffer_device_address(_hits_buffer));
+    pc.residency = gfx::to<uint32_t *>(
+        _context->get_buffer_device_address(_residency_buffer));
+    pc.views = 1;
+    pc.target = render_storage_image;
+    pc.visible_instances = gfx::to<uint32_t *>(
+        _context->get_buffer_device_address(_visible_instances_buffer));
 
-    _gpu_timer->start(cbuf, "raygen");
-    _context->cmd_bind_pipeline(cbuf, _raygen_pipeline);
-    _context->cmd_bind_descriptor_sets(cbuf, _raygen_pipeline, 0,
-                                       {_base->_bindless_descriptor_set});
-    _context->cmd_push_constants(cbuf, _raygen_pipeline, VK_SHADER_STAGE_ALL, 0,
-                                 sizeof(push_constant_raytracing_t), &pc);
-    _context->cmd_dispatch(cbuf, (_width + 8 - 1) / 8, (_height + 8 - 1) / 8,
-                           1);
-    _gpu_timer->end(cbuf, "raygen");
+    if (trace_primary && _hybrid_primary)
+      rasterize_visibility(cbuf, render_width, render_height);
+
+    if (trace_primary && _cull_instances && !_hybrid_primary) {
+      _gpu_timer->start(cbuf, "cull");
+      push_constant_cull_t cull_pc{};
+      cull_pc.camera = pc.camera;
+      cull_pc.instances = pc.instances;
+      cull_pc.num_blas_instances = _num_blas_instances;
+      cull_pc.visible_instances = pc.visible_instances;
+      cull_pc.max_distance = _cull_distance;
+      _context->cmd_bind_pipeline(cbuf, _cull_pipeline);
+      _context->cmd_bind_descriptor_sets(cbuf, _cull_pipeline, 0,
+                                         {_base->_bindless_descriptor_set});
+      _context->cmd_push_constants(cbuf, _cull_pipeline, VK_SHADER_STAGE_ALL,
+                                   0, sizeof(push_constant_cull_t), &cull_pc);
+      _context->cmd_dispatch(cbuf, 1, 1, 1);
+      _gpu_timer->end(cbuf, "cull");
+      _context->cmd_buffer_memory_barrier(
+          cbuf, _visible_instances_buffer,
+          _context->get_buffer(_visible_instances_buffer).config.vk_size, 0,
+          VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    }
+
+    if (trace_primary) {
+      _gpu_timer->start(cbuf, "raygen");
+      _context->cmd_bind_pipeline(cbuf, raygen_pipeline);
+      _context->cmd_bind_descriptor_sets(cbuf, raygen_pipeline, 0,
+                                         {_base->_bindless_descriptor_set});
+      _context->cmd_push_constants(cbuf, raygen_pipeline,
+                                   VK_SHADER_STAGE_ALL, 0,
+                                   sizeof(push_constant_raytracing_t), &pc);
+      _context->cmd_dispatch(cbuf, (render_width + 8 - 1) / 8,
+                             (render_height + 8 - 1) / 8, 1);
+      _gpu_timer->end(cbuf, "raygen");
+    }
     _context->cmd_buffer_memory_barrier(
         cbuf, _ray_data_buffer,
         _context->get_buffer(_ray_data_buffer).config.vk_size, 0,
@@ -452,19 +2068,22 @@ gfx::handle_image_view_t renderer_t::render(core::ref<ecs::scene_t<>> scene,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
     _context->cmd_image_memory_barrier(
-        cbuf, _raytrace_image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+        cbuf, _render_image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
         VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
 
-    _gpu_timer->start(cbuf, "trace");
-    _context->cmd_bind_pipeline(cbuf, _trace_pipeline);
-    _context->cmd_bind_descriptor_sets(cbuf, _trace_pipeline, 0,
-                                       {_base->_bindless_descriptor_set});
-    _context->cmd_push_constants(cbuf, _trace_pipeline, VK_SHADER_STAGE_ALL, 0,
-                                 sizeof(push_constant_raytracing_t), &pc);
-    _context->cmd_dispatch(cbuf, (_width * _height + 64 - 1) / 64, 1, 1);
-    _gpu_timer->end(cbuf, "trace");
+    if (trace_primary) {
+      _gpu_timer->start(cbuf, "trace");
+      _context->cmd_bind_pipeline(cbuf, trace_pipeline);
+      _context->cmd_bind_descriptor_sets(cbuf, trace_pipeline, 0,
+                                         {_base->_bindless_descriptor_set});
+      _context->cmd_push_constants(cbuf, trace_pipeline, VK_SHADER_STAGE_ALL,
+                                   0, sizeof(push_constant_raytracing_t), &pc);
+      _context->cmd_dispatch(
+          cbuf, (render_width * render_height + 64 - 1) / 64, 1, 1);
+      _gpu_timer->end(cbuf, "trace");
+    }
     _context->cmd_buffer_memory_barrier(
         cbuf, _hits_buffer, _context->get_buffer(_hits_buffer).config.vk_size,
         0, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
@@ -472,18 +2091,48 @@ gfx::handle_image_view_t renderer_t::render(core::ref<ecs::scene_t<>> scene,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
 
     _gpu_timer->start(cbuf, "shade");
-    _context->cmd_bind_pipeline(cbuf, _shade_pipeline);
-    _context->cmd_bind_descriptor_sets(cbuf, _shade_pipeline, 0,
+    _context->cmd_bind_pipeline(cbuf, shade_pipeline);
+    _context->cmd_bind_descriptor_sets(cbuf, shade_pipeline, 0,
                                        {_base->_bindless_descriptor_set});
-    _context->cmd_push_constants(cbuf, _shade_pipeline, VK_SHADER_STAGE_ALL, 0,
+    _context->cmd_push_constants(cbuf, shade_pipeline, VK_SHADER_STAGE_ALL, 0,
                                  sizeof(push_constant_raytracing_t), &pc);
-    _context->cmd_dispatch(cbuf, (_width * _height + 64 - 1) / 64, 1, 1);
+    _context->cmd_dispatch(cbuf, (render_width * render_height + 64 - 1) / 64,
+                           1, 1);
     _gpu_timer->end(cbuf, "shade");
     _context->cmd_image_memory_barrier(
-        cbuf, _raytrace_image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+        cbuf, _render_image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
         VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+    // aovs are read after render returns, by compute or fragment shaders
+    for (gfx::handle_image_t aov_image : _aov_images)
+      if (aov_image != core::null_handle)
+        _context->cmd_image_memory_barrier(
+            cbuf, aov_image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+            VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+                VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+    if (_denoise)
+      denoise(cbuf, render_width, render_height);
+
+    push_constant_upscale_t upscale_pc{};
+    upscale_pc.src_width = render_width;
+    upscale_pc.src_height = render_height;
+    upscale_pc.dst_width = _width;
+    upscale_pc.dst_height = _height;
+
+    _gpu_timer->start(cbuf, "upscale");
+    _context->cmd_bind_pipeline(cbuf, _upscale_pipeline);
+    _context->cmd_bind_descriptor_sets(cbuf, _upscale_pipeline, 0,
+                                       {_base->_bindless_descriptor_set});
+    _context->cmd_push_constants(cbuf, _upscale_pipeline, VK_SHADER_STAGE_ALL,
+                                 0, sizeof(push_constant_upscale_t),
+                                 &upscale_pc);
+    _context->cmd_dispatch(cbuf, (_width + 8 - 1) / 8, (_height + 8 - 1) / 8,
+                           1);
+    _gpu_timer->end(cbuf, "upscale");
 
     _context->cmd_image_memory_barrier(
         cbuf, _raytrace_image, VK_IMAGE_LAYOUT_GENERAL,
@@ -495,10 +2144,404 @@ gfx::handle_image_view_t renderer_t::render(core::ref<ecs::scene_t<>> scene,
   return _raytrace_image_view;
 }
 
+gfx::handle_image_view_t
+renderer_t::render_views(core::ref<ecs::scene_t<>> scene,
+                         const std::vector<core::camera_t> &cameras,
+                         uint32_t width, uint32_t height) {
+  assert(!cameras.empty());
+  const uint32_t count = cameras.size();
+  auto cbuf = _base->current_commandbuffer();
+
+  apply_settings();
+  update_scene(scene, cbuf);
+  reserve_views(width, height, count);
+  upload_instances(cbuf);
+
+  camera_t *shader_cameras =
+      reinterpret_cast<camera_t *>(_context->map_buffer(_views_camera_buffer));
+  for (uint32_t i = 0; i < count; i++) {
+    camera_t &shader_camera = shader_cameras[i];
+    shader_camera.view = cameras[i].view;
+    shader_camera.projection = cameras[i].projection;
+    shader_camera.inv_view = core::inverse(shader_camera.view);
+    shader_camera.inv_projection = core::inverse(shader_camera.projection);
+    // views have no history, nothing reads motion here
+    shader_camera.prev_view = shader_camera.view;
+    shader_camera.prev_projection = shader_camera.projection;
+  }
+
+  const gfx::handle_pipeline_t trace_pipeline = permutation_pipeline(
+      "trace", _trace_pipeline_layout,
+      {
+          {"PHOTON_STATS", _debug_view != debug_view_t::e_none ? "1" : "0"},
+          {"PHOTON_STACK_SIZE", std::to_string(_stack_size)},
+          {"PHOTON_ROOT_LEAF", _root_leaf_instances ? "1" : "0"},
+          {"PHOTON_VALIDATION", _validation ? "1" : "0"},
+          {"PHOTON_WAVE_TRAVERSAL", _wave_traversal ? "1" : "0"},
+          {"PHOTON_SOA", _soa_rays ? "1" : "0"},
+          {"PHOTON_COMPACT_RAYS", _compact_rays ? "1" : "0"},
+      });
+  const gfx::handle_pipeline_t shade_pipeline = permutation_pipeline(
+      "shade", _shade_pipeline_layout,
+      {
+          {"PHOTON_DEBUG_VIEW", std::to_string(uint32_t(_debug_view))},
+          {"PHOTON_VALIDATION", _validation ? "1" : "0"},
+          {"PHOTON_AOVS", "0"},
+          {"PHOTON_SOA", _soa_rays ? "1" : "0"},
+          {"PHOTON_COMPACT_RAYS", _compact_rays ? "1" : "0"},
+      });
+  const gfx::handle_pipeline_t raygen_pipeline = permutation_pipeline(
+      "raygen", _raygen_pipeline_layout,
+      {
+          {"PHOTON_SOA", _soa_rays ? "1" : "0"},
+          {"PHOTON_COMPACT_RAYS", _compact_rays ? "1" : "0"},
+      });
+  // trace marks instances used, update_residency must age them this frame
+  _last_frame_traced = true;
+
+  _context->cmd_image_memory_barrier(
+      cbuf, _views_image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+      0, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+  push_constant_raytracing_t pc{};
+  pc.width = width;
+  pc.height = height;
+  pc.ray_data = gfx::to<ray_data_t *>(
+      _context->get_buffer_device_address(_views_ray_data_buffer));
+  pc.camera = gfx::to<camera_t *>(
+      _context->get_buffer_device_address(_views_camera_buffer));
+  pc.param = gfx::to<current_raytracing_param_t *>(
+      _context->get_buffer_device_address(_views_param_buffer));
+  pc.tlas = 0; // NOTE: DONT USE
+  pc.num_blas_instances = _num_blas_instances;
+  pc.instances = gfx::to<bvh_instance_t *>(
+      _context->get_buffer_device_address(_instances_buffer));
+  pc.hits =
+      gfx::to<hit_t *>(_context->get_buffer_device_address(_views_hits_buffer));
+  pc.residency = gfx::to<uint32_t *>(
+      _context->get_buffer_device_address(_residency_buffer));
+  pc.views = count;
+  pc.target = views_storage_image;
+
+  _gpu_timer->start(cbuf, "views");
+  _context->cmd_bind_pipeline(cbuf, raygen_pipeline);
+  _context->cmd_bind_descriptor_sets(cbuf, raygen_pipeline, 0,
+                                     {_base->_bindless_descriptor_set});
+  _context->cmd_push_constants(cbuf, raygen_pipeline, VK_SHADER_STAGE_ALL, 0,
+                               sizeof(push_constant_raytracing_t), &pc);
+  _context->cmd_dispatch(cbuf, (width + 8 - 1) / 8, (height + 8 - 1) / 8,
+                         count);
+  _context->cmd_buffer_memory_barrier(
+      cbuf, _views_ray_data_buffer,
+      _context->get_buffer(_views_ray_data_buffer).config.vk_size, 0,
+      VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+  _context->cmd_buffer_memory_barrier(
+      cbuf, _views_param_buffer,
+      _context->get_buffer(_views_param_buffer).config.vk_size, 0,
+      VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+  const uint32_t ray_groups = (width * height * count + 64 - 1) / 64;
+  _context->cmd_bind_pipeline(cbuf, trace_pipeline);
+  _context->cmd_bind_descriptor_sets(cbuf, trace_pipeline, 0,
+                                     {_base->_bindless_descriptor_set});
+  _context->cmd_push_constants(cbuf, trace_pipeline, VK_SHADER_STAGE_ALL, 0,
+                               sizeof(push_constant_raytracing_t), &pc);
+  _context->cmd_dispatch(cbuf, ray_groups, 1, 1);
+  _context->cmd_buffer_memory_barrier(
+      cbuf, _views_hits_buffer,
+      _context->get_buffer(_views_hits_buffer).config.vk_size, 0,
+      VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+  _context->cmd_bind_pipeline(cbuf, shade_pipeline);
+  _context->cmd_bind_descriptor_sets(cbuf, shade_pipeline, 0,
+                                     {_base->_bindless_descriptor_set});
+  _context->cmd_push_constants(cbuf, shade_pipeline, VK_SHADER_STAGE_ALL, 0,
+                               sizeof(push_constant_raytracing_t), &pc);
+  _context->cmd_dispatch(cbuf, ray_groups, 1, 1);
+  _gpu_timer->end(cbuf, "views");
+
+  // read after render_views returns, by compute or fragment shaders
+  _context->cmd_image_memory_barrier(
+      cbuf, _views_image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL,
+      VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+          VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+  return _views_image_view;
+}
+
+void renderer_t::cmd_trace_rays(gfx::handle_commandbuffer_t cbuf,
+                                gfx::handle_buffer_t rays,
+                                gfx::handle_buffer_t hits, uint32_t count) {
+  // no PHOTON_SOA, callers read and write ray_data_t and hit_t records
+  const gfx::handle_pipeline_t trace_pipeline = permutation_pipeline(
+      "trace", _trace_pipeline_layout,
+      {
+          {"PHOTON_STATS", "0"},
+          {"PHOTON_STACK_SIZE", std::to_string(_stack_size)},
+          {"PHOTON_ROOT_LEAF", _root_leaf_instances ? "1" : "0"},
+          {"PHOTON_VALIDATION", _validation ? "1" : "0"},
+          {"PHOTON_WAVE_TRAVERSAL", _wave_traversal ? "1" : "0"},
+      });
+
+  // views 0, trace reads count from width and no camera or param
+  push_constant_raytracing_t pc{};
+  pc.width = count;
+  pc.height = 1;
+  pc.views = 0;
+  pc.ray_data =
+      gfx::to<ray_data_t *>(_context->get_buffer_device_address(rays));
+  pc.num_blas_instances = _num_blas_instances;
+  pc.instances = gfx::to<bvh_instance_t *>(
+      _context->get_buffer_device_address(_instances_buffer));
+  pc.hits = gfx::to<hit_t *>(_context->get_buffer_device_address(hits));
+  pc.residency = gfx::to<uint32_t *>(
+      _context->get_buffer_device_address(_residency_buffer));
+  // queries are submitted ahead of the frame, the first one clears the flags
+  clear_residency(cbuf);
+
+  _context->cmd_bind_pipeline(cbuf, trace_pipeline);
+  _context->cmd_bind_descriptor_sets(cbuf, trace_pipeline, 0,
+                                     {_base->_bindless_descriptor_set});
+  _context->cmd_push_constants(cbuf, trace_pipeline, VK_SHADER_STAGE_ALL, 0,
+                               sizeof(push_constant_raytracing_t), &pc);
+  _context->cmd_dispatch(cbuf, (count + 64 - 1) / 64, 1, 1);
+}
+
+std::future<std::vector<hit_t>>
+renderer_t::trace_rays(const std::vector<ray_data_t> &rays) {
+  if (rays.empty() || _instances.empty()) {
+    // nothing to trace against, every ray misses
+    std::promise<std::vector<hit_t>> promise;
+    promise.set_value(std::vector<hit_t>(rays.size()));
+    return promise.get_future();
+  }
+
+  ray_query_t &query = _ray_queries.emplace_back();
+  query.count = rays.size();
+
+  gfx::config_buffer_t cb{};
+  cb.vk_buffer_usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  cb.vma_allocation_create_flags =
+      VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+  cb.vk_size = rays.size() * sizeof(ray_data_t);
+  query.rays = _context->create_buffer(cb);
+  std::memcpy(_context->map_buffer(query.rays), rays.data(), cb.vk_size);
+  cb.vk_buffer_usage_flags =
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  cb.vma_allocation_create_flags =
+      VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT;
+  cb.vk_size = rays.size() * sizeof(hit_t) + sizeof(uint32_t);
+  query.hits = _context->create_buffer(cb);
+  uint32_t *done = reinterpret_cast<uint32_t *>(
+      reinterpret_cast<uint8_t *>(_context->map_buffer(query.hits)) +
+      rays.size() * sizeof(hit_t));
+  *done = 0;
+  return query.promise.get_future();
+}
+
+void renderer_t::submit_ray_queries() {
+  for (ray_query_t &query : _ray_queries)
+    if (query.fence == core::null_handle)
+      submit_ray_query(query);
+}
+
+void renderer_t::submit_ray_query(ray_query_t &query) {
+  const VkDeviceSize hits_size =
+      query.count * sizeof(hit_t) + sizeof(uint32_t);
+  query.cbuf = _context->allocate_commandbuffer(
+      {.handle_command_pool = _base->_command_pool});
+  _context->begin_commandbuffer(query.cbuf, true);
+  // after the builds, refits and instance uploads of frames submitted before
+  _context->cmd_buffer_memory_barrier(
+      query.cbuf, _instances_buffer,
+      _context->get_buffer(_instances_buffer).config.vk_size, 0,
+      VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_ACCESS_SHADER_READ_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+  cmd_trace_rays(query.cbuf, query.rays, query.hits, query.count);
+  // the done word lands after the hits, polling it needs no fence status
+  _context->cmd_buffer_memory_barrier(
+      query.cbuf, query.hits, hits_size, 0, VK_ACCESS_SHADER_WRITE_BIT,
+      VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT);
+  _context->cmd_copy_buffer(query.cbuf, _query_done_buffer, query.hits,
+                            VkBufferCopy{
+                                .srcOffset = 0,
+                                .dstOffset = query.count * sizeof(hit_t),
+                                .size = sizeof(uint32_t),
+                            });
+  _context->cmd_buffer_memory_barrier(
+      query.cbuf, query.hits, hits_size, 0,
+      VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_ACCESS_HOST_READ_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_HOST_BIT);
+  _context->end_commandbuffer(query.cbuf);
+
+  query.fence = _context->create_fence({});
+  _context->submit_commandbuffer(query.cbuf, {}, {}, {}, query.fence);
+}
+
+void renderer_t::invalidate_buffer(gfx::handle_buffer_t buffer) {
+  vmaInvalidateAllocation(_context->_vma_allocator,
+                          _context->get_buffer(buffer).vma_allocation, 0,
+                          VK_WHOLE_SIZE);
+}
+
+void renderer_t::poll_ray_queries(bool wait) {
+  auto itr = _ray_queries.begin();
+  while (itr != _ray_queries.end()) {
+    ray_query_t &query = *itr;
+    if (query.fence == core::null_handle) {
+      ++itr;
+      continue;
+    }
+    const hit_t *hits =
+        reinterpret_cast<const hit_t *>(_context->map_buffer(query.hits));
+    const uint32_t *done =
+        reinterpret_cast<const uint32_t *>(hits + query.count);
+    invalidate_buffer(query.hits);
+    if (!wait && *done == 0) {
+      ++itr;
+      continue;
+    }
+    // returns right away once done is set, the command buffer may be freed
+    _context->wait_fence(query.fence);
+    // the hits may have landed after done was first read
+    invalidate_buffer(query.hits);
+    query.promise.set_value(std::vector<hit_t>(hits, hits + query.count));
+    _context->destroy_fence(query.fence);
+    _context->free_commandbuffer(query.cbuf);
+    _context->destroy_buffer(query.rays);
+    _context->destroy_buffer(query.hits);
+    itr = _ray_queries.erase(itr);
+  }
+}
+
+void renderer_t::write_bvh_report(const std::filesystem::path &path) {
+  bvh_report_t total{};
+  std::ofstream file{path};
+  file << "{\"meshes\": [";
+  bool first = true;
+  for (auto &[id, reports] : _bvh_reports) {
+    for (uint32_t mesh_index = 0; mesh_index < reports.size(); mesh_index++) {
+      merge_bvh_report(total, reports[mesh_index]);
+      file << (first ? "" : ",") << "\n  {\"entity\": " << id
+           << ", \"mesh\": " << mesh_index
+           << ", \"report\": " << to_json(reports[mesh_index]) << "}";
+      first = false;
+    }
+  }
+  file << "],\n \"scene\": " << to_json(total) << "}\n";
+  if (!file)
+    horizon_warn("failed to write bvh report {}", path.string());
+}
+
 void renderer_t::gui() {
   ImGui::Begin("Photon Settings");
   ImGui::Text("%f", ImGui::GetIO().Framerate);
   ImGui::Text("%f %f", float(_width), float(_height));
+  ImGui::Checkbox("dynamic resolution", &_dynamic_resolution);
+  ImGui::SliderFloat("target frame time (ms)", &_target_frame_time, 1.f,
+                     100.f);
+  ImGui::SliderFloat("min render scale", &_min_render_scale, 0.1f, 1.f);
+  ImGui::Text("render scale %f", _render_scale);
+  ImGui::SliderFloat("rebuild sah threshold", &_rebuild_sah_threshold, 1.f,
+                     4.f);
+  ImGui::SliderInt("residency budget (mb, 0 = unlimited)",
+                   &_residency_budget_mb, 0, 16384);
+  const char *debug_views[] = {"none", "node heatmap", "primitive heatmap"};
+  int debug_view = int(_debug_view);
+  if (ImGui::Combo("debug view", &debug_view, debug_views, 3))
+    _debug_view = debug_view_t(debug_view);
+  // every size is a trace permutation compiled on first use, keep them few
+  const int stack_sizes[] = {16, 32, 64};
+  const char *stack_size_names[] = {"16", "32", "64"};
+  int stack_size = int(std::find(std::begin(stack_sizes),
+                                 std::end(stack_sizes), _stack_size) -
+                       std::begin(stack_sizes));
+  if (ImGui::Combo("traversal stack size", &stack_size, stack_size_names, 3))
+    _stack_size = stack_sizes[stack_size];
+  ImGui::Checkbox("wave traversal", &_wave_traversal);
+  ImGui::Checkbox("soa rays and hits", &_soa_rays);
+  bool compact_rays = _requested_compact_rays;
+  if (ImGui::Checkbox("compact rays", &compact_rays))
+    set_compact_rays(compact_rays);
+  ImGui::SliderFloat("lod pixel error (0 = full detail)", &_lod_pixel_error,
+                     0.f, 8.f);
+  ImGui::Checkbox("validation", &_validation);
+  ImGui::Checkbox("reuse primary hits", &_reuse_primary_hits);
+  ImGui::Checkbox("rasterized primary visibility", &_hybrid_primary);
+  ImGui::Checkbox("cull instances", &_cull_instances);
+  if (ImGui::SliderFloat("cull distance (0 = off)", &_cull_distance, 0.f,
+                         1000.f))
+    _primary_hits_valid = false;
+  ImGui::Text("primary rays %s", _last_frame_traced ? "traced" : "reused");
+  const char *aov_names[] = {"depth aov", "normal aov", "albedo aov",
+                             "motion aov", "ids aov"};
+  uint32_t aovs = _requested_aovs;
+  for (uint32_t i = 0; i < uint32_t(aov_t::e_count); i++) {
+    bool enabled = aovs & aov_bit(aov_t(i));
+    if (ImGui::Checkbox(aov_names[i], &enabled))
+      aovs ^= aov_bit(aov_t(i));
+  }
+  set_aovs(aovs);
+  bool denoise = _requested_denoise;
+  if (ImGui::Checkbox("denoise", &denoise))
+    set_denoise(denoise);
+  ImGui::SliderInt("a-trous iterations", &_denoise_iterations, 1, 5);
+  ImGui::SliderInt("max history", &_denoise_max_history, 1, 64);
+  ImGui::Text("models loading %zu", _pending_models.size());
+  if (ImGui::CollapsingHeader("bvh quality")) {
+    auto show = [](const bvh_report_t &report) {
+      ImGui::Text("sah %f epo %f sibling overlap %f", report.sah_cost,
+                  report.epo, report.sibling_overlap);
+      ImGui::Text("nodes %u leaves %u primitives %u, %fmb", report.node_count,
+                  report.leaf_count, report.primitive_count,
+                  report.bytes / (1024.f * 1024.f));
+      ImGui::Text("depth max %u average leaf %f", report.max_depth,
+                  report.average_leaf_depth);
+      std::vector<float> sizes(report.leaf_sizes.begin(),
+                               report.leaf_sizes.end());
+      ImGui::PlotHistogram("leaf sizes", sizes.data(), int(sizes.size()));
+      std::vector<float> depths(report.leaf_depths.begin(),
+                                report.leaf_depths.end());
+      ImGui::PlotHistogram("leaf depths", depths.data(), int(depths.size()));
+    };
+    bvh_report_t total{};
+    for (auto &[id, reports] : _bvh_reports)
+      for (auto &report : reports)
+        merge_bvh_report(total, report);
+    show(total);
+    if (ImGui::Button("write bvh_report.json"))
+      write_bvh_report("bvh_report.json");
+    for (auto &[id, reports] : _bvh_reports) {
+      if (!ImGui::TreeNode(&reports, "entity %u", uint32_t(id)))
+        continue;
+      for (uint32_t mesh_index = 0; mesh_index < reports.size();
+           mesh_index++) {
+        ImGui::PushID(int(mesh_index));
+        ImGui::Text("mesh %u", mesh_index);
+        if (reports[mesh_index].node_count)
+          show(reports[mesh_index]);
+        else
+          ImGui::Text("built on the gpu, not analyzed");
+        ImGui::PopID();
+      }
+      ImGui::TreePop();
+    }
+  }
+  ImGui::Text("resident pageable geometry %fmb",
+              _resident_geometry_size / (1024.f * 1024.f));
   for (auto [name, time] : _gpu_timer->get_times()) {
     ImGui::Text("%s took %fms", name.c_str(), time);
   }
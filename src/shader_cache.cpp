@@ -0,0 +1,211 @@
+#include "photon/shader_cache.hpp"
+
+#include "horizon/core/logger.hpp"
+#include "horizon/gfx/helper.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include <slang-com-ptr.h>
+#include <slang.h>
+
+namespace photon {
+
+namespace {
+
+// bump when the compile settings below change, old entries are then ignored
+constexpr uint32_t shader_cache_version = 2;
+
+const char *entry_point_name(gfx::shader_type_t type) {
+  switch (type) {
+  case gfx::shader_type_t::e_vertex:
+    return "vertex_main";
+  case gfx::shader_type_t::e_fragment:
+    return "fragment_main";
+  case gfx::shader_type_t::e_compute:
+    return "compute_main";
+  }
+  return "main";
+}
+
+slang::IGlobalSession *global_session() {
+  static Slang::ComPtr<slang::IGlobalSession> session = []() {
+    Slang::ComPtr<slang::IGlobalSession> session;
+    slang::createGlobalSession(session.writeRef());
+    return session;
+  }();
+  return session.get();
+}
+
+void report(slang::IBlob *diagnostics) {
+  if (diagnostics)
+    horizon_warn("{}",
+                 static_cast<const char *>(diagnostics->getBufferPointer()));
+}
+
+} // namespace
+
+shader_cache_t::shader_cache_t(core::ref<gfx::context_t> context,
+                               const std::filesystem::path &directory)
+    : _context(context), _directory(directory), _disk_cache(directory) {}
+
+uint64_t
+shader_cache_t::hash_source(const std::filesystem::path &path, uint64_t hash,
+                            std::vector<std::filesystem::path> &visited) {
+  std::filesystem::path canonical = std::filesystem::weakly_canonical(path);
+  if (std::find(visited.begin(), visited.end(), canonical) != visited.end())
+    return hash;
+  visited.push_back(canonical);
+
+  std::ifstream file{canonical};
+  std::string source{std::istreambuf_iterator<char>(file),
+                     std::istreambuf_iterator<char>()};
+  hash = hash_bytes(source.data(), source.size(), hash);
+
+  // #include "file" relative to the including file, like slang resolves it
+  size_t offset = 0;
+  while ((offset = source.find("#include", offset)) != std::string::npos) {
+    offset += 8;
+    size_t begin = source.find('"', offset);
+    size_t line_end = source.find('\n', offset);
+    if (begin == std::string::npos || begin > line_end)
+      continue;
+    size_t end = source.find('"', begin + 1);
+    if (end == std::string::npos || end > line_end)
+      continue;
+    hash = hash_source(canonical.parent_path() /
+                           source.substr(begin + 1, end - begin - 1),
+                       hash, visited);
+  }
+  return hash;
+}
+
+bool shader_cache_t::compile(const std::filesystem::path &path,
+                             gfx::shader_type_t type,
+                             const shader_defines_t &defines,
+                             std::vector<uint32_t> &spirv) {
+  slang::IGlobalSession *global = global_session();
+  if (!global)
+    return false;
+
+  // scalar buffer layout, what types.hpp mirrors, and row major matrices, so
+  // glm matrices read transposed and the shaders multiply as v * m
+  slang::TargetDesc target{};
+  target.format = SLANG_SPIRV;
+  target.profile = global->findProfile("spirv_1_5");
+  target.forceGLSLScalarBufferLayout = true;
+
+  std::string search_path = path.parent_path().string();
+  const char *search_paths[] = {search_path.c_str()};
+
+  std::vector<slang::PreprocessorMacroDesc> macros;
+  for (auto &[name, value] : defines)
+    macros.push_back({name.c_str(), value.c_str()});
+
+  slang::SessionDesc session_desc{};
+  session_desc.targets = &target;
+  session_desc.targetCount = 1;
+  session_desc.searchPaths = search_paths;
+  session_desc.searchPathCount = 1;
+  session_desc.preprocessorMacros = macros.data();
+  session_desc.preprocessorMacroCount = macros.size();
+  session_desc.defaultMatrixLayoutMode = SLANG_MATRIX_LAYOUT_ROW_MAJOR;
+
+  Slang::ComPtr<slang::ISession> session;
+  if (SLANG_FAILED(global->createSession(session_desc, session.writeRef())))
+    return false;
+
+  Slang::ComPtr<slang::IBlob> diagnostics;
+  slang::IModule *module =
+      session->loadModule(path.string().c_str(), diagnostics.writeRef());
+  report(diagnostics);
+  if (!module)
+    return false;
+
+  Slang::ComPtr<slang::IEntryPoint> entry_point;
+  if (SLANG_FAILED(module->findEntryPointByName(entry_point_name(type),
+                                                entry_point.writeRef())))
+    return false;
+
+  slang::IComponentType *components[] = {module, entry_point};
+  Slang::ComPtr<slang::IComponentType> program;
+  diagnostics.setNull();
+  if (SLANG_FAILED(session->createCompositeComponentType(
+          components, 2, program.writeRef(), diagnostics.writeRef()))) {
+    report(diagnostics);
+    return false;
+  }
+
+  Slang::ComPtr<slang::IComponentType> linked;
+  diagnostics.setNull();
+  if (SLANG_FAILED(program->link(linked.writeRef(), diagnostics.writeRef()))) {
+    report(diagnostics);
+    return false;
+  }
+
+  Slang::ComPtr<slang::IBlob> code;
+  diagnostics.setNull();
+  if (SLANG_FAILED(linked->getEntryPointCode(0, 0, code.writeRef(),
+                                             diagnostics.writeRef()))) {
+    report(diagnostics);
+    return false;
+  }
+
+  const uint32_t *words =
+      static_cast<const uint32_t *>(code->getBufferPointer());
+  spirv.assign(words, words + code->getBufferSize() / sizeof(uint32_t));
+  return true;
+}
+
+gfx::handle_shader_t
+shader_cache_t::create_shader(const std::filesystem::path &path,
+                              gfx::shader_type_t type,
+                              const shader_defines_t &defines) {
+  std::vector<std::filesystem::path> visited;
+  uint64_t key = hash_bytes(&shader_cache_version, sizeof(uint32_t));
+  key = hash_bytes(&type, sizeof(type), key);
+  for (auto &[name, value] : defines) {
+    key = hash_bytes(name.data(), name.size() + 1, key);
+    key = hash_bytes(value.data(), value.size() + 1, key);
+  }
+  key = hash_source(path, key, visited);
+
+  std::vector<uint32_t> spirv;
+  std::vector<uint8_t> bytes;
+  if (_disk_cache.load(key, bytes) && bytes.size() % sizeof(uint32_t) == 0) {
+    spirv.resize(bytes.size() / sizeof(uint32_t));
+    std::memcpy(spirv.data(), bytes.data(), bytes.size());
+  } else if (compile(path, type, defines, spirv)) {
+    _disk_cache.store(key, spirv.data(), spirv.size() * sizeof(uint32_t));
+  } else {
+    // let horizon compile it, it reports the errors the same way as before
+    horizon_warn("shader cache could not compile {}", path.string());
+    if (defines.empty())
+      return gfx::helper::create_slang_shader(*_context, path, type);
+    // horizon takes no defines, compile a wrapper that sets them instead
+    std::filesystem::path wrapper =
+        _directory /
+        (path.stem().string() + "_" + std::to_string(key) + ".slang");
+    {
+      std::ofstream file{wrapper};
+      for (auto &[name, value] : defines)
+        file << "#define " << name << " " << value << "\n";
+      file << "#include \""
+           << std::filesystem::weakly_canonical(path).generic_string()
+           << "\"\n";
+    }
+    return gfx::helper::create_slang_shader(*_context, wrapper, type);
+  }
+
+  gfx::config_shader_t cs{};
+  cs.name = path.filename().string();
+  cs.debug_name = path.filename().string();
+  cs.type = type;
+  cs.spirv = std::move(spirv);
+  return _context->create_shader(cs);
+}
+
+} // namespace photon
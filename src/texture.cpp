@@ -0,0 +1,193 @@
+#include "photon/texture.hpp"
+
+#include "horizon/core/logger.hpp"
+#include "horizon/gfx/context.hpp"
+#include "horizon/gfx/helper.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstring>
+
+#include <stb_image.h>
+
+namespace photon {
+
+namespace {
+
+float srgb_to_linear(float c) {
+  return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+float linear_to_srgb(float c) {
+  return c <= 0.0031308f ? c * 12.92f
+                         : 1.055f * std::pow(c, 1.f / 2.4f) - 0.055f;
+}
+
+// 8 bit srgb to linear, looked up instead of a pow per texel
+const std::array<float, 256> &srgb_table() {
+  static const std::array<float, 256> table = []() {
+    std::array<float, 256> table;
+    for (uint32_t i = 0; i < 256; i++)
+      table[i] = srgb_to_linear(i / 255.f);
+    return table;
+  }();
+  return table;
+}
+
+mip_level_t downsample(const mip_level_t &src, bool srgb) {
+  mip_level_t dst{};
+  dst.width = std::max(src.width / 2, 1u);
+  dst.height = std::max(src.height / 2, 1u);
+  dst.pixels.resize(dst.width * dst.height * 4);
+  const std::array<float, 256> &table = srgb_table();
+  for (uint32_t y = 0; y < dst.height; y++) {
+    const uint32_t y0 = std::min(2 * y, src.height - 1);
+    const uint32_t y1 = std::min(2 * y + 1, src.height - 1);
+    for (uint32_t x = 0; x < dst.width; x++) {
+      const uint32_t x0 = std::min(2 * x, src.width - 1);
+      const uint32_t x1 = std::min(2 * x + 1, src.width - 1);
+      const uint8_t *texels[4] = {
+          &src.pixels[(y0 * src.width + x0) * 4],
+          &src.pixels[(y0 * src.width + x1) * 4],
+          &src.pixels[(y1 * src.width + x0) * 4],
+          &src.pixels[(y1 * src.width + x1) * 4],
+      };
+      uint8_t *out = &dst.pixels[(y * dst.width + x) * 4];
+      for (uint32_t c = 0; c < 4; c++) {
+        // alpha is always linear
+        if (srgb && c < 3) {
+          float sum = 0;
+          for (const uint8_t *texel : texels)
+            sum += table[texel[c]];
+          out[c] = uint8_t(
+              std::lround(std::clamp(linear_to_srgb(sum / 4.f), 0.f, 1.f) *
+                          255.f));
+        } else {
+          uint32_t sum = 0;
+          for (const uint8_t *texel : texels)
+            sum += texel[c];
+          out[c] = uint8_t((sum + 2) / 4);
+        }
+      }
+    }
+  }
+  return dst;
+}
+
+} // namespace
+
+uint32_t mip_count(uint32_t width, uint32_t height) {
+  return std::bit_width(std::max({width, height, 1u}));
+}
+
+std::vector<mip_level_t> generate_mips(uint32_t width, uint32_t height,
+                                       const uint8_t *pixels, bool srgb) {
+  std::vector<mip_level_t> levels;
+  levels.reserve(mip_count(width, height));
+  mip_level_t &base_level = levels.emplace_back();
+  base_level.width = width;
+  base_level.height = height;
+  base_level.pixels.assign(pixels, pixels + width * height * 4);
+  while (levels.back().width > 1 || levels.back().height > 1)
+    levels.push_back(downsample(levels.back(), srgb));
+  return levels;
+}
+
+std::vector<mip_level_t> load_mips(const std::filesystem::path &path,
+                                   bool srgb) {
+  int width, height, channels;
+  stbi_uc *pixels =
+      stbi_load(path.string().c_str(), &width, &height, &channels, 4);
+  if (!pixels) {
+    horizon_warn("failed to load {}: {}", path.string(),
+                 stbi_failure_reason());
+    return {};
+  }
+  std::vector<mip_level_t> levels = generate_mips(width, height, pixels, srgb);
+  stbi_image_free(pixels);
+  return levels;
+}
+
+gfx::handle_image_t upload_mips(core::ref<gfx::base_t> base,
+                                const std::vector<mip_level_t> &levels,
+                                VkFormat format,
+                                const std::string &debug_name) {
+  core::ref<gfx::context_t> context = base->_context;
+
+  size_t size = 0;
+  for (auto &level : levels)
+    size += level.pixels.size();
+  gfx::config_buffer_t cb{};
+  cb.vk_size = size;
+  cb.vk_buffer_usage_flags = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  cb.vma_allocation_create_flags =
+      VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+  cb.debug_name = "mip staging";
+  gfx::handle_buffer_t staging = context->create_buffer(cb);
+  uint8_t *mapped = reinterpret_cast<uint8_t *>(context->map_buffer(staging));
+
+  gfx::config_image_t ci{};
+  ci.vk_width = levels[0].width;
+  ci.vk_height = levels[0].height;
+  ci.vk_depth = 1;
+  ci.vk_type = VK_IMAGE_TYPE_2D;
+  ci.vk_format = format;
+  ci.vk_usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  ci.vma_allocation_create_flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+  ci.vk_mips = levels.size();
+  ci.debug_name = debug_name;
+  gfx::handle_image_t image = context->create_image(ci);
+
+  gfx::handle_commandbuffer_t cbuf = context->allocate_commandbuffer(
+      {.handle_command_pool = base->_command_pool});
+  context->begin_commandbuffer(cbuf, true);
+  context->cmd_image_memory_barrier(
+      cbuf, image, VK_IMAGE_LAYOUT_UNDEFINED,
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT);
+  size_t offset = 0;
+  for (uint32_t mip = 0; mip < levels.size(); mip++) {
+    std::memcpy(mapped + offset, levels[mip].pixels.data(),
+                levels[mip].pixels.size());
+    VkBufferImageCopy region{};
+    region.bufferOffset = offset;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = mip;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = {levels[mip].width, levels[mip].height, 1};
+    context->cmd_copy_buffer_to_image(
+        cbuf, staging, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, region);
+    offset += levels[mip].pixels.size();
+  }
+  context->cmd_image_memory_barrier(
+      cbuf, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_ACCESS_SHADER_READ_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT |
+          VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+  context->end_commandbuffer(cbuf);
+
+  gfx::handle_fence_t fence = context->create_fence({});
+  context->submit_commandbuffer(cbuf, {}, {}, {}, fence);
+  context->wait_fence(fence);
+  context->destroy_fence(fence);
+  context->free_commandbuffer(cbuf);
+  context->destroy_buffer(staging);
+  return image;
+}
+
+gfx::handle_image_t load_image_with_mips(core::ref<gfx::base_t> base,
+                                         const std::filesystem::path &path,
+                                         VkFormat format) {
+  std::vector<mip_level_t> levels =
+      load_mips(path, format == VK_FORMAT_R8G8B8A8_SRGB);
+  // horizon reports the failure the same way as before
+  if (levels.empty())
+    return gfx::helper::load_image_from_path_instant(
+        *base->_context, base->_command_pool, path, format);
+  return upload_mips(base, levels, format, path.filename().string());
+}
+
+} // namespace photon
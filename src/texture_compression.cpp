@@ -0,0 +1,368 @@
+#include "photon/texture_compression.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <future>
+
+namespace photon {
+
+namespace {
+
+// bump when an encoder or the entry layout changes, old entries are ignored
+constexpr uint32_t texture_cache_version = 1;
+
+// rows of blocks per pool task
+constexpr uint32_t block_rows_per_task = 16;
+
+using block_t = std::array<std::array<uint8_t, 4>, 16>;
+
+uint32_t block_size(texture_compression_t compression) {
+  return compression == texture_compression_t::e_bc1 ? 8 : 16;
+}
+
+block_t load_block(const mip_level_t &level, uint32_t block_x,
+                   uint32_t block_y) {
+  block_t block;
+  for (uint32_t i = 0; i < 16; i++) {
+    const uint32_t x = std::min(block_x * 4 + i % 4, level.width - 1);
+    const uint32_t y = std::min(block_y * 4 + i / 4, level.height - 1);
+    std::memcpy(block[i].data(), &level.pixels[(y * level.width + x) * 4], 4);
+  }
+  return block;
+}
+
+/* the texels with the lowest and highest projection on the principal axis
+ * of the first channels channels, found by power iteration on the
+ * covariance, a flat block returns the same texel twice
+ * */
+template <uint32_t channels>
+void principal_endpoints(const block_t &block, uint32_t &low,
+                         uint32_t &high) {
+  float mean[channels] = {};
+  for (auto &texel : block)
+    for (uint32_t c = 0; c < channels; c++)
+      mean[c] += texel[c] / 16.f;
+  float covariance[channels][channels] = {};
+  for (auto &texel : block)
+    for (uint32_t a = 0; a < channels; a++)
+      for (uint32_t b = 0; b < channels; b++)
+        covariance[a][b] += (texel[a] - mean[a]) * (texel[b] - mean[b]);
+
+  float axis[channels];
+  for (uint32_t c = 0; c < channels; c++)
+    axis[c] = 1.f;
+  for (uint32_t iteration = 0; iteration < 8; iteration++) {
+    float next[channels] = {};
+    float largest = 0;
+    for (uint32_t a = 0; a < channels; a++) {
+      for (uint32_t b = 0; b < channels; b++)
+        next[a] += covariance[a][b] * axis[b];
+      largest = std::max(largest, std::abs(next[a]));
+    }
+    if (largest <= 0)
+      break;
+    for (uint32_t c = 0; c < channels; c++)
+      axis[c] = next[c] / largest;
+  }
+
+  float low_t = INFINITY, high_t = -INFINITY;
+  low = high = 0;
+  for (uint32_t i = 0; i < 16; i++) {
+    float t = 0;
+    for (uint32_t c = 0; c < channels; c++)
+      t += block[i][c] * axis[c];
+    if (t < low_t) {
+      low_t = t;
+      low = i;
+    }
+    if (t > high_t) {
+      high_t = t;
+      high = i;
+    }
+  }
+}
+
+template <uint32_t channels>
+uint32_t distance(const std::array<uint8_t, 4> &a, const uint8_t *b) {
+  uint32_t sum = 0;
+  for (uint32_t c = 0; c < channels; c++) {
+    const int32_t d = int32_t(a[c]) - int32_t(b[c]);
+    sum += d * d;
+  }
+  return sum;
+}
+
+uint16_t to_565(const std::array<uint8_t, 4> &color) {
+  return uint16_t(((color[0] * 31 + 127) / 255) << 11 |
+                  ((color[1] * 63 + 127) / 255) << 5 |
+                  (color[2] * 31 + 127) / 255);
+}
+
+std::array<uint8_t, 4> from_565(uint16_t color) {
+  const uint32_t r = color >> 11, g = (color >> 5) & 63, b = color & 31;
+  return {uint8_t(r << 3 | r >> 2), uint8_t(g << 2 | g >> 4),
+          uint8_t(b << 3 | b >> 2), 255};
+}
+
+void encode_bc1(const block_t &block, uint8_t *out) {
+  uint32_t low, high;
+  principal_endpoints<3>(block, low, high);
+  uint16_t color0 = to_565(block[high]);
+  uint16_t color1 = to_565(block[low]);
+  // color0 > color1 selects the 4 color mode, equal colors need no indices
+  if (color0 < color1)
+    std::swap(color0, color1);
+  uint32_t indices = 0;
+  if (color0 != color1) {
+    std::array<uint8_t, 4> palette[4] = {from_565(color0), from_565(color1)};
+    for (uint32_t c = 0; c < 3; c++) {
+      palette[2][c] = uint8_t((2 * palette[0][c] + palette[1][c] + 1) / 3);
+      palette[3][c] = uint8_t((palette[0][c] + 2 * palette[1][c] + 1) / 3);
+    }
+    for (uint32_t i = 0; i < 16; i++) {
+      uint32_t best = 0, best_distance = UINT32_MAX;
+      for (uint32_t p = 0; p < 4; p++) {
+        const uint32_t d = distance<3>(palette[p], block[i].data());
+        if (d < best_distance) {
+          best_distance = d;
+          best = p;
+        }
+      }
+      indices |= best << (2 * i);
+    }
+  }
+  out[0] = uint8_t(color0);
+  out[1] = uint8_t(color0 >> 8);
+  out[2] = uint8_t(color1);
+  out[3] = uint8_t(color1 >> 8);
+  for (uint32_t i = 0; i < 4; i++)
+    out[4 + i] = uint8_t(indices >> (8 * i));
+}
+
+// lsb first, like the bc7 bit layout, out must be zeroed
+struct bit_writer_t {
+  void write(uint32_t value, uint32_t bits) {
+    for (uint32_t i = 0; i < bits; i++, offset++)
+      if ((value >> i) & 1)
+        out[offset / 8] |= uint8_t(1 << (offset % 8));
+  }
+  uint8_t *out;
+  uint32_t offset = 0;
+};
+
+// 7 bit endpoint and the shared p bit that round trips color closest
+void quantize_bc7_endpoint(const std::array<uint8_t, 4> &color,
+                           std::array<uint8_t, 4> &quantized, uint32_t &p) {
+  uint32_t best_error = UINT32_MAX;
+  for (uint32_t candidate = 0; candidate < 2; candidate++) {
+    std::array<uint8_t, 4> q;
+    uint32_t error = 0;
+    for (uint32_t c = 0; c < 4; c++) {
+      const int32_t v = std::clamp(
+          int32_t(std::lround((color[c] - int32_t(candidate)) / 2.f)), 0,
+          127);
+      q[c] = uint8_t(v);
+      const int32_t d = int32_t(v << 1 | candidate) - color[c];
+      error += d * d;
+    }
+    if (error < best_error) {
+      best_error = error;
+      quantized = q;
+      p = candidate;
+    }
+  }
+}
+
+void encode_bc7(const block_t &block, uint8_t *out) {
+  static constexpr uint32_t weights[16] = {0,  4,  9,  13, 17, 21, 26, 30,
+                                           34, 38, 43, 47, 51, 55, 60, 64};
+  uint32_t low, high;
+  principal_endpoints<4>(block, low, high);
+  std::array<uint8_t, 4> endpoints[2];
+  uint32_t p[2];
+  quantize_bc7_endpoint(block[low], endpoints[0], p[0]);
+  quantize_bc7_endpoint(block[high], endpoints[1], p[1]);
+
+  uint8_t palette[16][4];
+  for (uint32_t w = 0; w < 16; w++)
+    for (uint32_t c = 0; c < 4; c++) {
+      const uint32_t e0 = endpoints[0][c] << 1 | p[0];
+      const uint32_t e1 = endpoints[1][c] << 1 | p[1];
+      palette[w][c] =
+          uint8_t(((64 - weights[w]) * e0 + weights[w] * e1 + 32) >> 6);
+    }
+  uint32_t indices[16];
+  for (uint32_t i = 0; i < 16; i++) {
+    uint32_t best_distance = UINT32_MAX;
+    for (uint32_t w = 0; w < 16; w++) {
+      const uint32_t d = distance<4>(block[i], palette[w]);
+      if (d < best_distance) {
+        best_distance = d;
+        indices[i] = w;
+      }
+    }
+  }
+  // the msb of the first index is implied 0, swap the endpoints otherwise
+  if (indices[0] & 8) {
+    std::swap(endpoints[0], endpoints[1]);
+    std::swap(p[0], p[1]);
+    for (uint32_t &index : indices)
+      index = 15 - index;
+  }
+
+  std::memset(out, 0, 16);
+  bit_writer_t writer{out};
+  writer.write(1 << 6, 7); // mode 6
+  for (uint32_t c = 0; c < 4; c++) {
+    writer.write(endpoints[0][c], 7);
+    writer.write(endpoints[1][c], 7);
+  }
+  writer.write(p[0], 1);
+  writer.write(p[1], 1);
+  writer.write(indices[0], 3);
+  for (uint32_t i = 1; i < 16; i++)
+    writer.write(indices[i], 4);
+}
+
+void encode_rows(const mip_level_t &level, mip_level_t &compressed,
+                 texture_compression_t compression, uint32_t row_begin,
+                 uint32_t row_end) {
+  const uint32_t blocks_x = (level.width + 3) / 4;
+  const uint32_t size = block_size(compression);
+  for (uint32_t y = row_begin; y < row_end; y++)
+    for (uint32_t x = 0; x < blocks_x; x++) {
+      uint8_t *out = &compressed.pixels[(y * blocks_x + x) * size];
+      if (compression == texture_compression_t::e_bc1)
+        encode_bc1(load_block(level, x, y), out);
+      else
+        encode_bc7(load_block(level, x, y), out);
+    }
+}
+
+/* cache entries, all uint32_t
+ *   version, level count, then width, height, byte size per level
+ * followed by the blocks of every level
+ * */
+std::vector<uint8_t> serialize(const std::vector<mip_level_t> &levels) {
+  std::vector<uint32_t> header{texture_cache_version, uint32_t(levels.size())};
+  size_t size = 0;
+  for (auto &level : levels) {
+    header.insert(header.end(),
+                  {level.width, level.height, uint32_t(level.pixels.size())});
+    size += level.pixels.size();
+  }
+  std::vector<uint8_t> bytes(header.size() * sizeof(uint32_t) + size);
+  std::memcpy(bytes.data(), header.data(), header.size() * sizeof(uint32_t));
+  size_t offset = header.size() * sizeof(uint32_t);
+  for (auto &level : levels) {
+    std::memcpy(bytes.data() + offset, level.pixels.data(),
+                level.pixels.size());
+    offset += level.pixels.size();
+  }
+  return bytes;
+}
+
+// false for entries of other versions or truncated ones
+bool deserialize(const std::vector<uint8_t> &bytes,
+                 std::vector<mip_level_t> &levels) {
+  auto read = [&](size_t index, uint32_t &value) {
+    if ((index + 1) * sizeof(uint32_t) > bytes.size())
+      return false;
+    std::memcpy(&value, bytes.data() + index * sizeof(uint32_t),
+                sizeof(uint32_t));
+    return true;
+  };
+  uint32_t version, count;
+  if (!read(0, version) || version != texture_cache_version ||
+      !read(1, count))
+    return false;
+  size_t offset = (2 + 3 * size_t(count)) * sizeof(uint32_t);
+  if (offset > bytes.size())
+    return false;
+  levels.resize(count);
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t size;
+    if (!read(2 + 3 * i, levels[i].width) ||
+        !read(3 + 3 * i, levels[i].height) || !read(4 + 3 * i, size) ||
+        offset + size > bytes.size())
+      return false;
+    levels[i].pixels.assign(bytes.begin() + offset,
+                            bytes.begin() + offset + size);
+    offset += size;
+  }
+  return count > 0;
+}
+
+} // namespace
+
+VkFormat compressed_format(texture_compression_t compression, bool srgb) {
+  switch (compression) {
+  case texture_compression_t::e_bc1:
+    return srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+  case texture_compression_t::e_bc7:
+    return srgb ? VK_FORMAT_BC7_SRGB_BLOCK : VK_FORMAT_BC7_UNORM_BLOCK;
+  case texture_compression_t::e_none:
+    break;
+  }
+  return srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+}
+
+std::vector<mip_level_t> compress_mips(const std::vector<mip_level_t> &levels,
+                                       texture_compression_t compression,
+                                       thread_pool_t *pool) {
+  if (compression == texture_compression_t::e_none)
+    return levels;
+  std::vector<mip_level_t> compressed(levels.size());
+  std::vector<std::future<void>> futures;
+  for (uint32_t i = 0; i < levels.size(); i++) {
+    const uint32_t blocks_y = (levels[i].height + 3) / 4;
+    compressed[i].width = levels[i].width;
+    compressed[i].height = levels[i].height;
+    compressed[i].pixels.resize(size_t((levels[i].width + 3) / 4) * blocks_y *
+                                block_size(compression));
+    for (uint32_t row = 0; row < blocks_y; row += block_rows_per_task) {
+      const uint32_t row_end = std::min(row + block_rows_per_task, blocks_y);
+      if (!pool) {
+        encode_rows(levels[i], compressed[i], compression, row, row_end);
+        continue;
+      }
+      futures.push_back(pool->submit([&, i, row, row_end]() {
+        encode_rows(levels[i], compressed[i], compression, row, row_end);
+      }));
+    }
+  }
+  for (auto &future : futures)
+    pool->wait(future);
+  return compressed;
+}
+
+std::vector<mip_level_t>
+load_compressed_mips(const std::filesystem::path &path, bool srgb,
+                     texture_compression_t compression,
+                     const disk_cache_t *cache, thread_pool_t *pool) {
+  uint64_t key = 0;
+  std::vector<mip_level_t> levels;
+  if (cache) {
+    key = hash_bytes(&texture_cache_version, sizeof(uint32_t));
+    key = hash_bytes(&compression, sizeof(compression), key);
+    key = hash_bytes(&srgb, sizeof(srgb), key);
+    key = hash_file(path, key);
+    std::vector<uint8_t> bytes;
+    if (cache->load(key, bytes) && deserialize(bytes, levels))
+      return levels;
+  }
+
+  levels = load_mips(path, srgb);
+  if (levels.empty())
+    return levels;
+  levels = compress_mips(levels, compression, pool);
+  if (cache) {
+    std::vector<uint8_t> bytes = serialize(levels);
+    cache->store(key, bytes.data(), bytes.size());
+  }
+  return levels;
+}
+
+} // namespace photon
@@ -0,0 +1,93 @@
+#include "photon/thread_pool.hpp"
+
+#include <algorithm>
+
+namespace photon {
+
+namespace {
+// pool and queue of the calling thread, if it is a worker
+thread_local const thread_pool_t *t_pool = nullptr;
+thread_local uint32_t t_queue = 0;
+} // namespace
+
+thread_pool_t::thread_pool_t(uint32_t thread_count) {
+  if (thread_count == 0)
+    thread_count = std::max(1u, std::thread::hardware_concurrency());
+  for (uint32_t i = 0; i < thread_count; i++)
+    _queues.push_back(std::make_unique<queue_t>());
+  for (uint32_t i = 0; i < thread_count; i++)
+    _threads.emplace_back([this, i]() { worker(i); });
+}
+
+thread_pool_t::~thread_pool_t() {
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _stop = true;
+  }
+  _condition.notify_all();
+  for (auto &thread : _threads)
+    thread.join();
+}
+
+void thread_pool_t::push(std::function<void()> task) {
+  uint32_t index = t_pool == this ? t_queue
+                                  : _next_queue.fetch_add(1) % _queues.size();
+  // counted before it can be taken, run_one never drops _pending below 0
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _pending++;
+  }
+  {
+    std::lock_guard<std::mutex> lock{_queues[index]->mutex};
+    _queues[index]->tasks.push_back(std::move(task));
+  }
+  _condition.notify_one();
+}
+
+bool thread_pool_t::pop(uint32_t index, std::function<void()> &task) {
+  std::lock_guard<std::mutex> lock{_queues[index]->mutex};
+  if (_queues[index]->tasks.empty())
+    return false;
+  task = std::move(_queues[index]->tasks.back());
+  _queues[index]->tasks.pop_back();
+  return true;
+}
+
+bool thread_pool_t::steal(uint32_t index, std::function<void()> &task) {
+  for (uint32_t i = 1; i <= _queues.size(); i++) {
+    queue_t &queue = *_queues[(index + i) % _queues.size()];
+    std::lock_guard<std::mutex> lock{queue.mutex};
+    if (queue.tasks.empty())
+      continue;
+    task = std::move(queue.tasks.front());
+    queue.tasks.pop_front();
+    return true;
+  }
+  return false;
+}
+
+bool thread_pool_t::run_one() {
+  uint32_t index = t_pool == this ? t_queue : 0;
+  std::function<void()> task;
+  if (!(t_pool == this && pop(index, task)) && !steal(index, task))
+    return false;
+  _pending--;
+  task();
+  return true;
+}
+
+void thread_pool_t::worker(uint32_t index) {
+  t_pool = this;
+  t_queue = index;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock{_mutex};
+      _condition.wait(lock, [this]() { return _stop || _pending > 0; });
+      if (_stop)
+        return;
+    }
+    run_one();
+  }
+}
+
+} // namespace photon
@@ -6,19 +6,142 @@
 #include "horizon/gfx/context.hpp"
 #include "horizon/gfx/helper.hpp"
 #include "horizon/gfx/types.hpp"
+#include "photon/bvh.hpp"
+#include "photon/geometry.hpp"
+#include "photon/texture.hpp"
+#include "photon/texture_compression.hpp"
 #include "photon/types.hpp"
 #include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <vulkan/vulkan_core.h>
 
 namespace photon {
 
-model_t raw_model_to_model(core::ref<gfx::base_t> base,
-                           const std::filesystem::path &photon_assets_path,
-                           const core::raw_model_t &raw_model) {
-  model_t model{};
+namespace {
+
+template <typename T> std::vector<uint8_t> to_bytes(const std::vector<T> &v) {
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(v.data());
+  return std::vector<uint8_t>(data, data + v.size() * sizeof(T));
+}
+
+} // namespace
+
+prepared_model_t prepare_model(const core::raw_model_t &raw_model,
+                               const std::filesystem::path &photon_assets_path,
+                               const model_options_t &options,
+                               thread_pool_t *pool,
+                               const disk_cache_t *texture_cache) {
+  prepared_model_t model{};
+  model.bvh_report = options.bvh_report;
 
   for (auto &raw_mesh : raw_model.meshes) {
+    prepared_mesh_t &mesh = model.meshes.emplace_back();
+    mesh.bvh_options = options.bvh_options;
+    // points and lines have no triangles to sort, build_bvh gives them a
+    // single empty leaf
+    if (raw_mesh.indices.size() < 3)
+      mesh.bvh_options.gpu_build = false;
+    mesh.deformable = options.deformable;
+    mesh.compact_geometry = options.compact_geometry && !mesh.deformable &&
+                            !mesh.bvh_options.gpu_build;
+    mesh.pageable = options.pageable && !mesh.deformable &&
+                    !mesh.bvh_options.gpu_build;
+    mesh.vertices = raw_mesh.vertices;
+    mesh.indices = raw_mesh.indices;
+
+    // what the bvh is built from, positions as the shaders decode them
+    std::vector<core::vertex_t> bvh_vertices{};
+    if (mesh.compact_geometry) {
+      mesh.quantization = quantization(raw_mesh.vertices);
+      mesh.compact_vertices.reserve(raw_mesh.vertices.size());
+      bvh_vertices = raw_mesh.vertices;
+      for (auto &vertex : bvh_vertices) {
+        mesh.compact_vertices.push_back(
+            compact_vertex(vertex, mesh.quantization));
+        vertex.position =
+            decode_position(mesh.compact_vertices.back(), mesh.quantization);
+      }
+    }
+
+    auto itr = std::find_if(raw_mesh.material_description.texture_infos.begin(),
+                            raw_mesh.material_description.texture_infos.end(),
+                            [](const core::texture_info_t info) {
+                              return info.texture_type ==
+                                     core::texture_type_t::e_diffuse_map;
+                            });
+    // TODO: cache default
+    mesh.diffuse_path =
+        itr != raw_mesh.material_description.texture_infos.end()
+            ? itr->file_path
+            : photon_assets_path / "textures" / "default.png";
+    mesh.diffuse_mips =
+        options.texture_compression == texture_compression_t::e_none
+            ? load_mips(mesh.diffuse_path, true)
+            : load_compressed_mips(mesh.diffuse_path, true,
+                                   options.texture_compression,
+                                   texture_cache, pool);
+    mesh.diffuse_format =
+        compressed_format(options.texture_compression, true);
+
+    mesh.aabb = {};
+    for (auto &vertex :
+         mesh.compact_geometry ? bvh_vertices : raw_mesh.vertices)
+      mesh.aabb.grow(vertex.position);
+
+    // gpu builds are filled by renderer_t::build_bvhs
+    if (mesh.bvh_options.gpu_build && !mesh.deformable)
+      continue;
+
+    mesh.triangles = extract_triangles(
+        mesh.compact_geometry ? bvh_vertices : raw_mesh.vertices,
+        raw_mesh.indices);
+    mesh.bvh = build_bvh(mesh.triangles, mesh.bvh_options, pool);
+    if (options.bvh_report)
+      mesh.bvh_report =
+          analyze_bvh(mesh.bvh, mesh.triangles, mesh.bvh_options.options);
+    if (mesh.compact_geometry) {
+      mesh.compact_triangles.reserve(mesh.triangles.size());
+      for (uint32_t i = 0; i < raw_mesh.indices.size(); i += 3)
+        mesh.compact_triangles.push_back(compact_triangle(
+            mesh.compact_vertices[raw_mesh.indices[i + 0]],
+            mesh.compact_vertices[raw_mesh.indices[i + 1]],
+            mesh.compact_vertices[raw_mesh.indices[i + 2]]));
+    }
+
+    if (!options.lod_levels || mesh.deformable || mesh.compact_geometry ||
+        mesh.pageable)
+      continue;
+    // the first level clusters to a 256 cell grid along the longest axis,
+    // each further one to a grid twice as coarse
+    const core::vec3 extent = mesh.aabb.max - mesh.aabb.min;
+    const float longest = std::max({extent.x, extent.y, extent.z});
+    size_t triangle_count = mesh.triangles.size();
+    for (float cell_size = longest / 256.f;
+         mesh.lods.size() < options.lod_levels && cell_size < longest;
+         cell_size *= 2.f) {
+      prepared_lod_t lod{};
+      cluster_vertices(raw_mesh.vertices, raw_mesh.indices, cell_size,
+                       lod.vertices, lod.indices);
+      if (lod.indices.empty())
+        break;
+      if (lod.indices.size() / 3 > triangle_count * 3 / 4)
+        continue;
+      triangle_count = lod.indices.size() / 3;
+      lod.error = cell_size * std::sqrt(3.f);
+      lod.triangles = extract_triangles(lod.vertices, lod.indices);
+      lod.bvh = build_bvh(lod.triangles, mesh.bvh_options, pool);
+      mesh.lods.push_back(std::move(lod));
+    }
+  }
+
+  return model;
+}
+
+model_t upload_model(core::ref<gfx::base_t> base, prepared_model_t &&prepared) {
+  model_t model{};
+
+  for (auto &prepared_mesh : prepared.meshes) {
     mesh_t &mesh = model.meshes.emplace_back();
     mesh.context = base->_context;
 
@@ -26,93 +149,128 @@ model_t raw_model_to_model(core::ref<gfx::base_t> base,
     cb.vk_buffer_usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
     cb.vma_allocation_create_flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
 
+    mesh.bvh_options = prepared_mesh.bvh_options;
+    mesh.deformable = prepared_mesh.deformable;
+    mesh.compact_geometry = prepared_mesh.compact_geometry;
+    mesh.quantization = prepared_mesh.quantization;
+    mesh.aabb = prepared_mesh.aabb;
+
     // upload mesh
-    mesh.vertex_count = raw_mesh.vertices.size();
-    cb.vk_size = raw_mesh.vertices.size() * sizeof(raw_mesh.vertices[0]);
-    mesh.vertex_buffer = gfx::helper::create_buffer_staged(
-        *base->_context, base->_command_pool, cb, raw_mesh.vertices.data(),
-        cb.vk_size);
-
-    mesh.index_count = raw_mesh.indices.size();
-    cb.vk_size = raw_mesh.indices.size() * sizeof(raw_mesh.indices[0]);
+    auto &vertices = prepared_mesh.vertices;
+    auto &compact_vertices = prepared_mesh.compact_vertices;
+    mesh.vertex_count = vertices.size();
+    cb.vk_size = vertices.size() * sizeof(vertices[0]);
+    if (mesh.compact_geometry) {
+      cb.vk_size = compact_vertices.size() * sizeof(compact_vertices[0]);
+      mesh.vertex_buffer = gfx::helper::create_buffer_staged(
+          *base->_context, base->_command_pool, cb, compact_vertices.data(),
+          cb.vk_size);
+    } else if (mesh.deformable) {
+      // rewritten by copies renderer_t::refit records for update_vertices
+      cb.vk_buffer_usage_flags |= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+      mesh.vertex_buffer = gfx::helper::create_buffer_staged(
+          *base->_context, base->_command_pool, cb, vertices.data(),
+          cb.vk_size);
+      cb.vk_buffer_usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    } else {
+      mesh.vertex_buffer = gfx::helper::create_buffer_staged(
+          *base->_context, base->_command_pool, cb, vertices.data(),
+          cb.vk_size);
+    }
+
+    auto &indices = prepared_mesh.indices;
+    mesh.index_count = indices.size();
+    cb.vk_size = indices.size() * sizeof(indices[0]);
     mesh.index_buffer = gfx::helper::create_buffer_staged(
-        *base->_context, base->_command_pool, cb, raw_mesh.indices.data(),
-        cb.vk_size);
+        *base->_context, base->_command_pool, cb, indices.data(), cb.vk_size);
 
     // upload texture
-    auto itr = std::find_if(raw_mesh.material_description.texture_infos.begin(),
-                            raw_mesh.material_description.texture_infos.end(),
-                            [](const core::texture_info_t info) {
-                              return info.texture_type ==
-                                     core::texture_type_t::e_diffuse_map;
-                            });
+    // TODO: handle image deletion
+    mesh.material.diffuse =
+        prepared_mesh.diffuse_mips.empty()
+            ? gfx::helper::load_image_from_path_instant(
+                  *base->_context, base->_command_pool,
+                  prepared_mesh.diffuse_path, VK_FORMAT_R8G8B8A8_SRGB)
+            : upload_mips(base, prepared_mesh.diffuse_mips,
+                          prepared_mesh.diffuse_format,
+                          prepared_mesh.diffuse_path.filename().string());
+    mesh.material.diffuse_view = base->_context->create_image_view(
+        {.handle_image = mesh.material.diffuse});
+    mesh.material.diffuse_bindless = base->new_bindless_image();
+    base->set_bindless_image(mesh.material.diffuse_bindless,
+                             mesh.material.diffuse_view,
+                             VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+    const bool pageable = prepared_mesh.pageable;
 
-    if (itr != raw_mesh.material_description.texture_infos.end()) {
-      // TODO: handle image deletion
-      mesh.material.diffuse = gfx::helper::load_image_from_path_instant(
-          *base->_context, base->_command_pool, itr->file_path,
-          VK_FORMAT_R8G8B8A8_SRGB);
-      mesh.material.diffuse_view = base->_context->create_image_view(
-          {.handle_image = mesh.material.diffuse});
-      mesh.material.diffuse_bindless = base->new_bindless_image();
-      base->set_bindless_image(mesh.material.diffuse_bindless,
-                               mesh.material.diffuse_view,
-                               VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    if (mesh.bvh_options.gpu_build && !mesh.deformable) {
+      // filled by renderer_t::build_bvhs before the mesh is first traced
+      const uint32_t triangle_count = mesh.index_count / 3;
+      cb.vk_size = triangle_count * sizeof(triangle_t);
+      mesh.bvh_triangles_buffer = base->_context->create_buffer(cb);
+      cb.vk_size = (2 * triangle_count - 1) * sizeof(core::bvh::node_t);
+      mesh.nodes_buffer = base->_context->create_buffer(cb);
+      cb.vk_size = triangle_count * sizeof(uint32_t);
+      mesh.primitive_index_buffer = base->_context->create_buffer(cb);
+      mesh.root_is_leaf = triangle_count == 1;
     } else {
-      // TODO: cache default
-      mesh.material.diffuse = gfx::helper::load_image_from_path_instant(
-          *base->_context, base->_command_pool,
-          photon_assets_path.string() + "/textures/default.png",
-          VK_FORMAT_R8G8B8A8_SRGB);
-      mesh.material.diffuse_view = base->_context->create_image_view(
-          {.handle_image = mesh.material.diffuse});
-      mesh.material.diffuse_bindless = base->new_bindless_image();
-      base->set_bindless_image(mesh.material.diffuse_bindless,
-                               mesh.material.diffuse_view,
-                               VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+      auto &triangles = prepared_mesh.triangles;
+      auto &compact_triangles = prepared_mesh.compact_triangles;
+      if (mesh.compact_geometry) {
+        cb.vk_size = compact_triangles.size() * sizeof(compact_triangles[0]);
+        mesh.bvh_triangles_buffer = gfx::helper::create_buffer_staged(
+            *base->_context, base->_command_pool, cb,
+            compact_triangles.data(), cb.vk_size);
+        if (pageable) {
+          mesh.host_geometry.vertices = to_bytes(compact_vertices);
+          mesh.host_geometry.bvh_triangles = to_bytes(compact_triangles);
+        }
+      } else {
+        cb.vk_size = triangles.size() * sizeof(triangles[0]);
+        mesh.bvh_triangles_buffer = gfx::helper::create_buffer_staged(
+            *base->_context, base->_command_pool, cb, triangles.data(),
+            cb.vk_size);
+        if (pageable) {
+          mesh.host_geometry.vertices = to_bytes(vertices);
+          mesh.host_geometry.bvh_triangles = to_bytes(triangles);
+        }
+      }
+
+      upload_bvh(base, mesh, prepared_mesh.bvh);
+      if (pageable) {
+        mesh.host_geometry.indices = to_bytes(indices);
+        mesh.host_geometry.nodes = to_bytes(prepared_mesh.bvh.nodes);
+        mesh.host_geometry.primitive_indices =
+            to_bytes(prepared_mesh.bvh.primitive_indices);
+      }
+    }
+
+    if (mesh.deformable) {
+      mesh.vertices = std::move(vertices);
+      mesh.indices = std::move(indices);
     }
 
-    std::vector<core::aabb_t> aabbs{};
-    std::vector<core::vec3> centers{};
-    std::vector<triangle_t> triangles{};
-    for (uint32_t i = 0; i < raw_mesh.indices.size(); i += 3) {
-      triangle_t triangle{
-          .v0 = raw_mesh.vertices[raw_mesh.indices[i + 0]].position,
-          .v1 = raw_mesh.vertices[raw_mesh.indices[i + 1]].position,
-          .v2 = raw_mesh.vertices[raw_mesh.indices[i + 2]].position,
+    for (auto &prepared_lod : prepared_mesh.lods) {
+      auto upload = [&](const auto &data) {
+        cb.vk_size = data.size() * sizeof(data[0]);
+        return gfx::helper::create_buffer_staged(
+            *base->_context, base->_command_pool, cb, data.data(), cb.vk_size);
       };
-      triangles.push_back(triangle);
-      aabbs.push_back(triangle.aabb());
-      centers.push_back(triangle.center());
+      mesh_lod_t &lod = mesh.lods.emplace_back();
+      lod.vertex_buffer = upload(prepared_lod.vertices);
+      lod.index_buffer = upload(prepared_lod.indices);
+      lod.nodes_buffer = upload(prepared_lod.bvh.nodes);
+      lod.primitive_index_buffer = upload(prepared_lod.bvh.primitive_indices);
+      lod.bvh_triangles_buffer = upload(prepared_lod.triangles);
+      lod.index_count = prepared_lod.indices.size();
+      lod.root_is_leaf = prepared_lod.bvh.nodes[0].is_leaf;
+      lod.error = prepared_lod.error;
     }
 
-    core::bvh::options_t options{
-        .o_min_primitive_count = 1,
-        .o_max_primitive_count = 8,
-        .o_object_split_search_type =
-            core::bvh::object_split_search_type_t::e_binned_sah,
-        .o_primitive_intersection_cost = 1.1f,
-        .o_node_intersection_cost = 1.f,
-        .o_samples = 8,
-    };
-
-    core::bvh::bvh_t bvh = core::bvh::build_bvh2(aabbs.data(), centers.data(),
-                                                 triangles.size(), options);
-
-    cb.vk_size = triangles.size() * sizeof(triangles[0]);
-    mesh.bvh_triangles_buffer = gfx::helper::create_buffer_staged(
-        *base->_context, base->_command_pool, cb, triangles.data(), cb.vk_size);
-    cb.vk_size = bvh.nodes.size() * sizeof(bvh.nodes[0]);
-    mesh.nodes_buffer = gfx::helper::create_buffer_staged(
-        *base->_context, base->_command_pool, cb, bvh.nodes.data(), cb.vk_size);
-    cb.vk_size =
-        bvh.primitive_indices.size() * sizeof(bvh.primitive_indices[0]);
-    mesh.primitive_index_buffer = gfx::helper::create_buffer_staged(
-        *base->_context, base->_command_pool, cb, bvh.primitive_indices.data(),
-        cb.vk_size);
-
-    cb.vma_allocation_create_flags =
-        VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT;
+    // written by copies renderer_t::update_scene records
+    cb.vk_buffer_usage_flags =
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    cb.vma_allocation_create_flags = {};
     cb.vk_size = sizeof(core::mat4);
     mesh.model_buffer = base->_context->create_buffer(cb);
     mesh.inv_model_buffer = base->_context->create_buffer(cb);
@@ -121,4 +279,73 @@ model_t raw_model_to_model(core::ref<gfx::base_t> base,
   return model;
 }
 
+model_t raw_model_to_model(core::ref<gfx::base_t> base,
+                           const std::filesystem::path &photon_assets_path,
+                           const core::raw_model_t &raw_model,
+                           const model_options_t &options) {
+  return upload_model(base,
+                      prepare_model(raw_model, photon_assets_path, options));
+}
+
+std::vector<gfx::handle_buffer_t> evict_geometry(mesh_t &mesh) {
+  assert(mesh.resident && mesh.host_geometry.size() &&
+         "only resident pageable meshes can be evicted");
+  std::vector<gfx::handle_buffer_t> buffers{
+      mesh.vertex_buffer, mesh.index_buffer, mesh.nodes_buffer,
+      mesh.primitive_index_buffer, mesh.bvh_triangles_buffer};
+  mesh.vertex_buffer = core::null_handle;
+  mesh.index_buffer = core::null_handle;
+  mesh.nodes_buffer = core::null_handle;
+  mesh.primitive_index_buffer = core::null_handle;
+  mesh.bvh_triangles_buffer = core::null_handle;
+  mesh.resident = false;
+  return buffers;
+}
+
+void page_in_geometry(core::ref<gfx::base_t> base, mesh_t &mesh) {
+  assert(!mesh.resident && "mesh is already resident");
+  gfx::config_buffer_t cb{};
+  cb.vk_buffer_usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  cb.vma_allocation_create_flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+  auto upload = [&](const std::vector<uint8_t> &bytes) {
+    cb.vk_size = bytes.size();
+    return gfx::helper::create_buffer_staged(
+        *base->_context, base->_command_pool, cb, bytes.data(), cb.vk_size);
+  };
+  mesh.vertex_buffer = upload(mesh.host_geometry.vertices);
+  mesh.index_buffer = upload(mesh.host_geometry.indices);
+  mesh.nodes_buffer = upload(mesh.host_geometry.nodes);
+  mesh.primitive_index_buffer = upload(mesh.host_geometry.primitive_indices);
+  mesh.bvh_triangles_buffer = upload(mesh.host_geometry.bvh_triangles);
+  mesh.resident = true;
+}
+
+void upload_bvh(core::ref<gfx::base_t> base, mesh_t &mesh,
+                const core::bvh::bvh_t &bvh) {
+  gfx::config_buffer_t cb{};
+  cb.vk_buffer_usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  cb.vma_allocation_create_flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+
+  mesh.root_is_leaf = bvh.nodes[0].is_leaf;
+  cb.vk_size = bvh.nodes.size() * sizeof(bvh.nodes[0]);
+  mesh.nodes_buffer = gfx::helper::create_buffer_staged(
+      *base->_context, base->_command_pool, cb, bvh.nodes.data(), cb.vk_size);
+  cb.vk_size = bvh.primitive_indices.size() * sizeof(bvh.primitive_indices[0]);
+  mesh.primitive_index_buffer = gfx::helper::create_buffer_staged(
+      *base->_context, base->_command_pool, cb, bvh.primitive_indices.data(),
+      cb.vk_size);
+
+  if (!mesh.deformable)
+    return;
+
+  std::vector<uint32_t> refit_order{};
+  refit_levels(bvh, refit_order, mesh.refit_level_offsets);
+  cb.vk_size = refit_order.size() * sizeof(refit_order[0]);
+  mesh.refit_order_buffer = gfx::helper::create_buffer_staged(
+      *base->_context, base->_command_pool, cb, refit_order.data(), cb.vk_size);
+
+  mesh.build_sah_cost = sah_cost(bvh, mesh.bvh_options.options);
+  mesh.refit_sah_cost = mesh.build_sah_cost;
+}
+
 } // namespace photon